@@ -0,0 +1,64 @@
+#!/bin/sh
+# Compara los recorridos de `du` de simplesh sobre un árbol sintético:
+# nftw (por defecto), statx por lotes con io_uring (-i) y sus variantes
+# con varios hilos (-j). Para cada uno imprime el mejor tiempo de REPS
+# ejecuciones y comprueba que todos dan el mismo total; si alguno
+# difiere, termina con estado distinto de cero.
+#
+# Uso: bench/du.sh [DIRECTORIOS] [FICHEROS_POR_DIRECTORIO] [REPS]
+
+DIRS=${1:-200}
+FILES=${2:-200}
+REPS=${3:-5}
+SIMPLESH=${SIMPLESH:-$(dirname "$0")/../simplesh}
+
+TREE=$(mktemp -d) || exit 1
+trap 'rm -rf "$TREE"' EXIT INT TERM
+
+echo "Creando $DIRS directorios con $FILES ficheros en $TREE"
+d=0
+while [ $d -lt "$DIRS" ]; do
+    mkdir -p "$TREE/d$((d % 10))/d$d"
+    f=0
+    while [ $f -lt "$FILES" ]; do
+        printf '%*s' $((f % 4096)) '' > "$TREE/d$((d % 10))/d$d/f$f"
+        f=$((f + 1))
+    done
+    d=$((d + 1))
+done
+
+now() {
+    date +%s%N
+}
+
+run() {
+    best=
+    for r in $(seq "$REPS"); do
+        t0=$(now)
+        out=$("$SIMPLESH" -c "du $1 $TREE" 2>/dev/null)
+        t1=$(now)
+        ms=$(( (t1 - t0) / 1000000 ))
+        if [ -z "$best" ] || [ $ms -lt "$best" ]; then
+            best=$ms
+        fi
+    done
+    total=${out##*: }
+    printf '%-12s %6d ms   %s\n' "du $1" "$best" "$total"
+    if [ -z "$total" ]; then
+        echo "du $1: sin total" >&2
+        status=1
+    elif [ -z "$ref" ]; then
+        ref=$total
+    elif [ "$total" != "$ref" ]; then
+        echo "du $1: total $total distinto de $ref" >&2
+        status=1
+    fi
+}
+
+ref=
+status=0
+run ""
+run "-i"
+run "-j 4"
+run "-j 4 -i"
+exit $status
@@ -0,0 +1,57 @@
+#!/bin/sh
+# Mide la velocidad de `parse_cmd()` en MB/s: genera un guion de unas
+# MB megas con órdenes variadas y lo analiza con `simplesh -n`, que no
+# ejecuta nada. Al mejor tiempo de REPS ejecuciones se le resta el de un
+# guion vacío, para descontar el arranque del proceso. Se mide sin la
+# caché de órdenes analizadas y con ella; como el guion repite las mismas
+# líneas, con caché casi todas se reconstruyen sin analizarlas.
+#
+# Uso: bench/parse.sh [MB] [REPS]
+# Con SIMPLESH=ruta se puede comparar otra compilación.
+
+MB=${1:-16}
+REPS=${2:-5}
+SIMPLESH=${SIMPLESH:-$(dirname "$0")/../simplesh}
+
+SCRIPT=$(mktemp) || exit 1
+EMPTY=$(mktemp) || exit 1
+trap 'rm -f "$SCRIPT" "$EMPTY"' EXIT INT TERM
+
+# Se duplica un bloque de líneas hasta llegar al tamaño pedido.
+cat > "$SCRIPT" <<'LINES'
+ls -l /usr/share/doc/simplesh/examples | grep -v README > /tmp/listado.txt
+cd /var/log ; du -b -t 10M . ; pwd
+(sort -u nombres.txt | uniq -c) >> recuento.log &
+tee -a /tmp/salida-intermedia.log < entrada.csv | wc -l
+    find . -name core	-size +1000k ;   echo   terminado
+LINES
+while [ "$(wc -c < "$SCRIPT")" -lt $((MB * 1024 * 1024)) ]; do
+    cat "$SCRIPT" "$SCRIPT" > "$SCRIPT.2" && mv "$SCRIPT.2" "$SCRIPT"
+done
+BYTES=$(wc -c < "$SCRIPT")
+
+now() {
+    date +%s%N
+}
+
+best() {
+    b=
+    for r in $(seq "$REPS"); do
+        t0=$(now)
+        SIMPLESH_PCACHE=$2 "$SIMPLESH" -n "$1" || exit 1
+        t1=$(now)
+        ns=$((t1 - t0))
+        if [ -z "$b" ] || [ $ns -lt "$b" ]; then
+            b=$ns
+        fi
+    done
+    echo "$b"
+}
+
+base=$(best "$EMPTY" 0)
+for pcache in 0 256; do
+    total=$(best "$SCRIPT" $pcache)
+    ns=$((total - base))
+    [ $ns -gt 0 ] || ns=1
+    echo "caché $pcache: $BYTES bytes en $((ns / 1000000)) ms: $((BYTES * 1000 / ns)) MB/s"
+done
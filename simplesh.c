@@ -1,1148 +1,5441 @@
-/*
-    GRUPO 1.2
-    Antonio Saavedra Sanchez
-    Jorge Gallego Madrid
-*/
-
-
-// Shell `simplesh`
-#define _XOPEN_SOURCE 500 
-#include <unistd.h>
-#include <errno.h>
-#include <string.h>
-#include <fcntl.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <pwd.h>
-#include <libgen.h>
-#include <getopt.h>
-#include <ftw.h>
-
-#include <sys/time.h>
-#include <sys/types.h>
-#include <sys/wait.h>
-#include <sys/stat.h>
-
-// Libreadline
-#include <readline/readline.h>
-#include <readline/history.h>
-
-
-// Tipos presentes en la estructura `cmd`, campo `type`.
-#define EXEC  1
-#define REDIR 2
-#define PIPE  3
-#define LIST  4
-#define BACK  5
-
-#define MAXARGS 15
-#define MAXPATH 256
-#define READSIZE 512
-
-// Timeout inicial de simplesh
-#define INITIAL_TIMEOUT 5
-
-// Flags para el open en tee
-#define AOPENFLAGS O_WRONLY|O_APPEND|O_CREAT
-#define OPENFLAGS O_WRONLY|O_TRUNC|O_CREAT
-
-// Estructuras
-// -----
-
-// La estructura `cmd` se utiliza para almacenar la información que
-// servirá al shell para guardar la información necesaria para
-// ejecutar las diferentes tipos de órdenes (tuberías, redirecciones,
-// etc.)
-//
-// El formato es el siguiente:
-//
-//     |----------+--------------+--------------|
-//     | (1 byte) | ...          | ...          |
-//     |----------+--------------+--------------|
-//     | type     | otros campos | otros campos |
-//     |----------+--------------+--------------|
-//
-// Nótese cómo las estructuras `cmd` comparten el primer campo `type`
-// para identificar el tipo de la estructura, y luego se obtendrá un
-// tipo derivado a través de *casting* forzado de tipo. Se obtiene así
-// un polimorfismo básico en C.
-struct cmd {
-    int type;
-};
-
-// Ejecución de un comando con sus parámetros
-struct execcmd {
-    int type;
-    char * argv[MAXARGS];
-    char * eargv[MAXARGS];
-};
-
-// Ejecución de un comando de redirección
-struct redircmd {
-    int type;
-    struct cmd *cmd;
-    char *file;
-    char *efile;
-    int mode;
-    int fd;
-};
-
-// Ejecución de un comando de tubería
-struct pipecmd {
-    int type;
-    struct cmd *left;
-    struct cmd *right;
-};
-
-// Lista de órdenes
-struct listcmd {
-    int type;
-    struct cmd *left;
-    struct cmd *right;
-};
-
-// Tarea en segundo plano (background) con `&`.
-struct backcmd {
-    int type;
-    struct cmd *cmd;
-};
-
-// Declaración de funciones necesarias
-int fork1(void);  // Fork but panics on failure.
-void panic(char*);
-struct cmd *parse_cmd(char*);
-
-// Boletin 2, ejercicio 3. Función para implementar el comando pwd como un comando interno.
-void run_pwd(){
-    char path[MAXPATH];
-    // Obtenemos el path actual.
-    char * ruta = getcwd(path, MAXPATH);
-    if (ruta == NULL){
-        perror("getcwd");
-        exit(EXIT_FAILURE);
-    }
-    fprintf(stderr, "simplesh: pwd: ");
-    fprintf(stdout, "%s\n", ruta);
-    exit(0);
-}
-
-
-// Boletin 2, ejercicio 5. Función para implementar el comando cd como un comando interno.
-void run_cd(struct cmd *command){
-    struct execcmd *comm = (struct execcmd*)command;
-    char *route;
-    // Si no se le pasa argumento se cambia al directorio home
-    if (comm->argv[1] == NULL)
-        route = getenv("HOME");
-    // Si se recibe, se cambia al directorio indicado como argumento.
-    else
-        route = comm->argv[1];
-    if (chdir(route) == -1){
-        perror("cd");
-        // Tratamos errores del cd y solo nos salimos si no es alguno de los errores 
-        // indicados, ya que éstos no son fatales y la ejecución puede continuar sin
-        // ningún problema.
-        if (errno != ENOENT && errno != EACCES && errno != ENOTDIR)
-            exit(EXIT_FAILURE);
-    }
-    return;
-    
-}
-
-// Boletin 3, opcional. Comando tee añade una línea al fichero $HOME/.tee.log.
-void print_teelog(int bytes, int files){
-    int pid, euid;
-    struct timeval tv;
-    time_t tm;
-    char tmbuf[20];
-    pid = getpid();
-    euid = geteuid();
-    
-    if(gettimeofday(&tv, NULL) == -1)
-        perror("gettimeofday");
-    else{
-        // Obtenemos fecha y hora
-        tm = tv.tv_sec;
-        struct tm * tiempo = localtime(&tm);
-        strftime(tmbuf, sizeof tmbuf, "%Y-%m-%d %H:%M:%S", tiempo);
-        // Guardamos en output la línea a escribir.
-        char output[64];
-        int chars = sprintf(output, "%s:PID %d:EUID %d:%d byte(s):%d file(s)\n", tmbuf, pid, euid, bytes, files);
-        char* file = "/.tee.log";
-        char * home = getenv("HOME");
-        char path[32];
-        sprintf(path, "%s%s", home, file);
-        // Abrimos el fichero en modo append
-        int descr = open(path, AOPENFLAGS, S_IRWXU);        
-        if (descr != -1){
-           if(write(descr, output, chars) == -1)
-            perror("write");
-        }
-        else
-            perror("open");
-    }
-}
-
-// Boletin 3, ejercicio 1. Función para implementar el comando tee como un comando interno
-void run_tee(struct execcmd* ecmd){
-    int cont=0;
-    int opt;
-    int aflag = 0;
-    int hflag = 0;
-    // Contamos el numero de argumentos
-    while (ecmd->argv[cont])
-        cont++;
-    // Procesamos los parámetros
-    while ((opt = getopt(cont, ecmd->argv, "ha")) != -1){
-        switch (opt){
-            case 'h':
-                hflag = 1;
-                break;
-            case 'a':
-                aflag = 1;
-                break;
-            case '?':
-                hflag = 1;
-                break;
-        }
-    }
-    
-    // Si se encuentra la opción h o no se reconoce alguna de las que se introducen,
-    // se muestra la ayuda y se ignoran el resto de opciones.
-    if (hflag){
-        fprintf(stdout, "Uso: tee [-h] [-a] [FICHERO]\n"\
-                            "\tCopia stdin a cada FICHERO y a stdout\n"\
-                            "\tOpciones:\n"\
-                            "\t-a Añade al final de cada FICHERO\n"\
-                            "\t-h help\n");
-    }
-    else{
-        // Calculamos el número de ficheros que se pasan como argumento
-        int numFich = cont-optind;
-        int descriptor[numFich];
-        int flag;
-        // Definimos los flags del open en funcion de la opción -a, si se encuentra
-        // usamos el O_APPEND, si no, O_TRUNC.
-        if (aflag)
-            flag = AOPENFLAGS;
-        else
-            flag = OPENFLAGS;
-        
-        // Abrimos los ficheros    
-        for (int i = 0; i < numFich; i++) {
-            descriptor[i] = open(ecmd->argv[i+optind], flag, S_IRWXU);
-            if(descriptor[i] == -1){
-                perror("open");
-            }
-        }
-        
-        char buf[READSIZE];
-        int bytesLeidos = 0;
-        int bytesEscritos = 0;
-        int aux = 0;
-        int bytes = 0;
-        // Leemos de stdin
-        while ((bytesLeidos = read(STDIN_FILENO, buf, READSIZE)) > 0){
-            bytes += bytesLeidos;
-            while (bytesEscritos != bytesLeidos){
-                // Escribimos a stdout
-                aux = write(STDOUT_FILENO, buf, bytesLeidos);
-                if (aux != -1)
-                    bytesEscritos+= aux;
-                else{
-                    perror ("write");
-                }
-            }
-            bytesEscritos = 0;
-            // Escribimos en cada fichero
-            for (int i = 0; i < numFich; i++) {
-                if (descriptor[i] != -1){
-                    while(bytesEscritos != bytesLeidos){
-                        aux = write(descriptor[i], buf, bytesLeidos);
-                        if (aux != -1)
-                            bytesEscritos += aux;
-                        else
-                            perror("write");
-                    }
-                    bytesEscritos = 0;
-                }
-            }
-        }
-        if (bytesLeidos == -1)
-            perror("read");
-        // Nos aseguramos que los ficheros han sido escritos a disco.
-        for (int i = 0; i < numFich; i++){
-            if (descriptor[i] != -1){
-                if (fsync(descriptor[i]) == -1)
-                    perror("fsync");
-                // Cerramos solo los ficheros que se pudieron abrir con éxito.
-                if (close(descriptor[i]) == -1)
-                    perror("close");
-            }
-        }
-        print_teelog(bytes, numFich);
-    }
-    exit(0);
-}
-
-// Variables globales static para la función auxiliar.
-static int totalSize = 0;
-static int du_bflag = 0; // Tamaño en disco de los bloques
-static int du_vflag = 0; // Verbose, imprime el tamaño de todos
-static int du_tflag = 0; // Restriccion de tamaño
-static int size = 0;
-
-int du_aux(const char *fpath, const struct stat *sb,
-            int tflag, struct FTW *ftwbuf){
-    int discarded = 0;
-    int sizethreshold = 0;
-    if (du_tflag){
-        sizethreshold = size;
-        // Comprobamos las restricciones del comando -t.
-        if (S_ISREG(sb->st_mode) && !((sizethreshold > 0 && sb->st_size < sizethreshold)  
-            || (sizethreshold < 0 && sb->st_size > sizethreshold*-1)
-            || sizethreshold == 0)){
-            discarded = 1;                                 
-        }
-    }
-    
-    // Si no se ha descartado el fichero se imprime la información
-    // dependiendo de las opciones.
-    if (!discarded){
-        if (du_vflag){
-            for (int i = 0; i < ftwbuf->level; i++) {
-                fprintf(stdout, "\t");
-            }
-            fprintf(stdout, "%s", fpath);
-        }
-        
-        if (S_ISREG(sb->st_mode)){
-            if (du_bflag)
-                totalSize += (sb->st_blocks*512);
-            else 
-                totalSize += (int) sb->st_size;
-            if (du_vflag && du_bflag)
-                fprintf(stdout, ": %zu\n", sb->st_blocks*512);
-            else if (du_vflag)
-                fprintf(stdout, ": %zu\n", sb->st_size);
-        }
-        else if(du_vflag)
-            fprintf(stdout, "\n");
-    }
-    return 0; /* To tell nftw() to continue */
-}
-
-// Boletin 4, ejercicio 1 y opcional.
-void run_du(struct execcmd *ecmd){
-    int opt;
-    int cont = 0;
-    int du_hflag = 0;
-    // Contamos el número de argumentos
-    while (ecmd->argv[cont])
-        cont++;
-    // Procesamos los parámetros
-    while ((opt = getopt(cont, ecmd->argv, "hbvt:")) != -1){
-        switch (opt){
-            case 'h':
-                du_hflag = 1;
-                break;
-            case 'b':
-                du_bflag = 1;
-                break;
-            case 'v':
-                du_vflag = 1;
-                break;
-            case 't':
-                du_tflag = 1;
-                // Almacenamos el argumento de la opcion t
-                sscanf(optarg, "%d", &size);
-                break;
-            case '?':
-                du_hflag = 1;
-                break;
-        }
-    }
-    // Si se encuentra la opción h o no se reconoce alguna de las que se introducen,
-    // se muestra la ayuda y se ignoran el resto de opciones.
-    if (du_hflag){
-        fprintf(stdout, "Uso : du [-h] [- b] [ -t SIZE ] [-v ] [ FICHERO | DIRECTORIO ]\n"\
-        "Para cada fichero, imprime su tamaño.\n"\
-        "Para cada directorio, imprime la suma de los tamaños de todos los ficheros de\n"\
-            "\ttodos sus subdirectorios.\n"\
-            "\tOpciones :\n"\
-            "\t-b Imprime el tamaño ocupado en disco por todos los bloques del fichero.\n"\
-            "\t-t SIZE Excluye todos los ficheros más pequeños que SIZE bytes, si es\n"\
-            "\tnegativo, o más pequeños que SIZE bytes, si es negativo, cuando se\n"\
-                "\t\tprocesa un directorio .\n"\
-            "\t-v Imprime el tamaño de todos y cada uno de los ficheros cuando se procesa un\n"\
-                "\t\tdirectorio.\n" \
-            "\t-h help\n"\
-        "Nota: todos los tamaños están expresados en bytes\n");
-    }
-    else {
-        struct stat st;
-        int i = optind;
-        do{
-            char * path;
-            // Si no se pasan argumentos, la orden se aplica sobre
-            // el directorio actual.
-            path = i < cont ? ecmd->argv[i] : ".";
-            if (stat(path, &st) == -1) {
-                perror("stat");
-                exit(EXIT_FAILURE);
-            }
-            // Si es un directorio, usamos nftw para recorrerlo recursivamente,
-            // nos ayudamos de la funcion auxiliar du_aux.
-            if(S_ISDIR(st.st_mode)){
-                int flags = 0;
-                int nopenfd = 20;
-                totalSize = 0;
-                if (nftw(path, du_aux, 20, flags) == -1){
-                    perror("nftw");
-                    exit(EXIT_FAILURE);
-                }
-                fprintf(stdout,"(D) %s: %d\n", path, totalSize);
-            }
-            // Si es un fichero, se calcula la información a mostrar en función
-            // de las opciones seleccionadas.
-            else if (S_ISREG(st.st_mode)) {
-                int sizethreshold = 0;
-                if (du_tflag)
-                    sizethreshold = size;  
-                // Restricciones de tamaño con la opcion -t
-                if ((sizethreshold > 0 && st.st_size < sizethreshold) 
-                    || (sizethreshold < 0 && st.st_size > sizethreshold*-1)
-                    || sizethreshold == 0){
-                    fprintf(stdout,"(F) ");
-                    // En función de la opción -b, imprimimos el tamaño ocupado 
-                    // en disco por todos los bloques, o su tamaño.
-                    if (du_bflag)
-                        fprintf(stdout, "%s: %zu\n", path, st.st_blocks*512);
-                    else 
-                        fprintf(stdout, "%s: %zu\n", path, st.st_size);
-                }
-            }
-            i++;
-        } while (i < cont);
-    }
-    exit(0);
-}
-
-// Ejecuta un 'cmd'. Nunca retorna, ya que siempre se ejecuta en un
-// hijo lanzado con 'fork()'.
-void run_cmd(struct cmd *cmd){
-    int p[2];
-    struct backcmd *bcmd;
-    struct execcmd *ecmd;
-    struct listcmd *lcmd;
-    struct pipecmd *pcmd;
-    struct redircmd *rcmd;
-
-    if(cmd == 0)
-        exit(0);
-
-    switch(cmd->type)
-    {
-    default:
-        panic("run_cmd");
-
-        // Ejecución de una única orden.
-    case EXEC:
-        ecmd = (struct execcmd*)cmd;
-        if (ecmd->argv[0] == 0)
-            exit(0);
-        else if (strcmp(ecmd->argv[0], "pwd") == 0)
-            run_pwd();
-        else if (strcmp(ecmd->argv[0], "tee") == 0)
-            run_tee(ecmd);
-        else if (strcmp(ecmd->argv[0], "du") == 0)
-            run_du(ecmd);
-        else{
-            execvp(ecmd->argv[0], ecmd->argv);
-            // Si se llega aquí algo falló
-            fprintf(stderr, "exec %s failed\n", ecmd->argv[0]);
-            exit (1);
-        }
-        break;
-
-    case REDIR:
-        rcmd = (struct redircmd*)cmd;
-        close(rcmd->fd);
-        // Boletin 2, ejercicio 1. Añadimos los permisos para que los ficheros
-        // se creen con permisos 700.
-        if (open(rcmd->file, rcmd->mode, S_IRWXU) < 0)
-        {
-            fprintf(stderr, "open %s failed\n", rcmd->file);
-            exit(1);
-        }
-        run_cmd(rcmd->cmd);
-        break;
-
-    case LIST:
-        lcmd = (struct listcmd*)cmd;
-        if (fork1() == 0)
-            run_cmd(lcmd->left);
-        wait(NULL);
-        run_cmd(lcmd->right);
-        break;
-
-    case PIPE:
-        pcmd = (struct pipecmd*)cmd;
-        if (pipe(p) < 0)
-            panic("pipe");
-
-        // Ejecución del hijo de la izquierda
-        if (fork1() == 0)
-        {
-            close(1);
-            dup(p[1]);
-            close(p[0]);
-            close(p[1]);
-            run_cmd(pcmd->left);
-        }
-
-        // Ejecución del hijo de la derecha
-        if (fork1() == 0)
-        {
-            close(0);
-            dup(p[0]);
-            close(p[0]);
-            close(p[1]);
-            run_cmd(pcmd->right);
-        }
-        close(p[0]);
-        close(p[1]);
-
-        // Esperar a ambos hijos
-        wait(NULL);
-        wait(NULL);
-        break;
-
-    case BACK:
-        bcmd = (struct backcmd*)cmd;
-        if (fork1() == 0)
-            run_cmd(bcmd->cmd);
-        break;
-    }
-
-    // Salida normal, código 0.
-    exit(0);
-}
-
-// Muestra un *prompt* y lee lo que el usuario escribe usando la
-// librería readline. Ésta permite almacenar en el historial, utilizar
-// las flechas para acceder a las órdenes previas, búsquedas de
-// órdenes, etc.
-char* getcmd() {
-    char *buf;
-    int retval = 0;
-    // Obtenemos el nombre de usuario a partir del uid.
-	char* username = getpwuid(getuid())->pw_name;
-	if (username == NULL){
-		perror("getpwuid");
-		exit(EXIT_FAILURE);
-	}
-
-    // Obtenemos el path actual.
-	char path[MAXPATH];
-	if (getcwd(path, MAXPATH) == NULL){
-		perror("getcwd");
-		exit(EXIT_FAILURE);
-	}
-	// Boletin 2, ejercicio 2. Creamos el prompt quedandonos con el basename del path.
-	char prompt[MAXPATH];
-	snprintf(prompt, MAXPATH,"%s@%s$ ", username, basename(path));
-	
-    // Lee la entrada del usuario
-    buf = readline (prompt);
-    fflush(stdout);
-
-    // Si el usuario ha escrito algo, almacenarlo en la historia.
-    if(buf)
-        add_history (buf);
-
-    return buf;
-}
-
-static int count = 0;
-// Handler para SIGCHLD. Incrementa el contador.
-static void signal_handler(int sig){
-    if (sig == SIGCHLD) {
-        count ++;
-    }
-    return;
-}
-
-static int sigus_timeout = INITIAL_TIMEOUT;
-// Handler para incrementar o decrementar el timeout.
-static void sigus_handler(int sig){
-    if (sig == SIGUSR1){
-        sigus_timeout += 5;
-    }
-    else if (sig == SIGUSR2 && sigus_timeout > 5){
-        sigus_timeout -= 5;
-    }
-        
-}
-
-// MAIN ----
-
-int main(void) {
-    char* buf;
-    
-    // Creamos un set de señales
-    sigset_t blocked_signals;
-    // Nos aseguramos de que está vacío.
-    if (sigemptyset(&blocked_signals) == -1){
-        perror("sigemptyset");
-        exit(EXIT_FAILURE);
-    }
-    // Añadimos SIGINT y SIGCHLD
-    if (sigaddset(&blocked_signals, SIGINT) == -1){
-        perror("sigaddset");
-        exit(EXIT_FAILURE);
-    }
-    if (sigaddset(&blocked_signals, SIGCHLD) == -1){
-        perror("sigaddset");
-        exit(EXIT_FAILURE);
-    }
-    // Bloqueamos las señales del set creado, es decir, bloqueamos SIGINT y SIGCHLD.
-    if (sigprocmask(SIG_BLOCK, &blocked_signals, NULL) == -1){
-        perror("sigprocmask");
-        exit(EXIT_FAILURE);
-    }
-    // Le asignamos el manejador signal_handler a SIGCHLD.
-    struct sigaction sa;
-    sa.sa_handler = signal_handler;
-    if (sigaction(SIGCHLD, &sa, NULL) == -1){
-        perror("sigaction");
-        exit(EXIT_FAILURE);
-    }
-    //Le asignamos manejador a SIGUSR1 y SIGUSR2.
-    struct sigaction sigusr;
-    sigusr.sa_handler = sigus_handler;
-    if (sigaction(SIGUSR1, &sigusr, NULL) == -1){
-        perror("sigaction");
-        exit(EXIT_FAILURE);
-    }
-    if (sigaction(SIGUSR2, &sigusr, NULL) == -1){
-        perror("sigaction");
-        exit(EXIT_FAILURE);
-    }
-    
-
-    // Bucle de lectura y ejecución de órdenes.
-    while (NULL != (buf = getcmd()))
-    {
-        struct timespec timeout;
-        timeout.tv_sec = sigus_timeout;
-        timeout.tv_nsec = 0;
-        sigset_t sigc;
-        if (sigemptyset(&sigc) == -1){
-                perror("sigemptyset");
-                exit(EXIT_FAILURE);
-        }
-        if (sigaddset(&sigc, SIGCHLD) == -1){
-                perror("sigaddset");
-                exit(EXIT_FAILURE);
-        }
-        siginfo_t info;
-        // Parseamos el comando antes del bloque if else
-        struct cmd* command = parse_cmd(buf);
-        // Boletin 2, ejercicio 4.
-        // Añadimos en los dos ifs siguientes la comprobación de NULL para
-        // evitar violación de segmento cuando el comando está vacío.
-        if ((((struct execcmd*)command)->argv[0] != NULL) && strcmp(((struct execcmd*)command)->argv[0], "exit") == 0)
-            exit(0);
-        // Boletin 2, ejercicio 5.
-        else if ((((struct execcmd*)command)->argv[0] != NULL) && strcmp(((struct execcmd*)command)->argv[0], "cd") == 0)
-            run_cd(command);
-        // Crear siempre un hijo para ejecutar el comando leído
-        else{
-            // Creamos el proceso hijo y guardamos su PID
-            int pid = fork1();
-            // Si somos el hijo, ejecutamos el comando
-            if(pid == 0)
-                run_cmd(command);
-            // Esperamos a que expire el timeout o a que se reciba la señal SIGCHLD.
-            do{
-                if (sigtimedwait(&sigc, &info, &timeout) < 0) {
-                    // Si expira, matamos al proceso hijo.
-                	if (errno == EAGAIN) {
-            			fprintf(stderr, "simplesh: [%d] Matado hijo con PID %d\n", count, pid);
-            			kill (pid, SIGKILL);
-                	}
-                	else if (errno == EINTR){
-                	    continue;
-                	}
-                	else {
-            			perror ("sigtimedwait");
-            			exit(EXIT_FAILURE);
-                	}
-                }
-                // Cuando se reciba la señal SIGCHLD o expire el timeout, salimos del bucle.
-            	break;
-            } while (1);
-            // Esperamos al proceso hijo.
-            waitpid(pid, NULL, 0);
-            
-            //Para asegurarnos de que se ejecuta el handler de SIGCHLD, desbloqueamos
-            //la señal y la volvemos a bloquear para que salga de la cola de pendientes.
-            sigset_t blocked;
-            if (sigemptyset(&blocked) == -1){
-                perror("sigemptyset");
-                exit(EXIT_FAILURE);
-            }
-            if (sigaddset(&blocked, SIGCHLD) == -1){
-                perror("sigaddset");
-                exit(EXIT_FAILURE);
-            }
-            if (sigprocmask(SIG_UNBLOCK, &blocked, NULL) == -1){
-                perror("sigprocmask");
-                exit(EXIT_FAILURE);
-            }
-            if (sigprocmask(SIG_BLOCK, &blocked, NULL) == -1){
-                perror("sigprocmask");
-                exit(EXIT_FAILURE);
-            }
-        
-        }
-        free ((void*)buf);
-    } 
-
-    return 0;
-}
-
-void
-panic(char *s)
-{
-    fprintf(stderr, "%s\n", s);
-    exit(-1);
-}
-
-// Como `fork()` salvo que muestra un mensaje de error si no se puede
-// crear el hijo.
-int
-fork1(void)
-{
-    int pid;
-
-    pid = fork();
-    if(pid == -1)
-        panic("fork");
-    return pid;
-}
-
-// Constructores de las estructuras `cmd`.
-// ----
-
-// Construye una estructura `EXEC`.
-struct cmd*
-execcmd(void)
-{
-    struct execcmd *cmd;
-
-    cmd = malloc(sizeof(*cmd));
-    memset(cmd, 0, sizeof(*cmd));
-    cmd->type = EXEC;
-    return (struct cmd*)cmd;
-}
-
-// Construye una estructura de redirección.
-struct cmd*
-redircmd(struct cmd *subcmd, char *file, char *efile, int mode, int fd)
-{
-    struct redircmd *cmd;
-
-    cmd = malloc(sizeof(*cmd));
-    memset(cmd, 0, sizeof(*cmd));
-    cmd->type = REDIR;
-    cmd->cmd = subcmd;
-    cmd->file = file;
-    cmd->efile = efile;
-    cmd->mode = mode;
-    cmd->fd = fd;
-    return (struct cmd*)cmd;
-}
-
-// Construye una estructura de tubería (*pipe*).
-struct cmd*
-pipecmd(struct cmd *left, struct cmd *right)
-{
-    struct pipecmd *cmd;
-
-    cmd = malloc(sizeof(*cmd));
-    memset(cmd, 0, sizeof(*cmd));
-    cmd->type = PIPE;
-    cmd->left = left;
-    cmd->right = right;
-    return (struct cmd*)cmd;
-}
-
-// Construye una estructura de lista de órdenes.
-struct cmd*
-listcmd(struct cmd *left, struct cmd *right)
-{
-    struct listcmd *cmd;
-
-    cmd = malloc(sizeof(*cmd));
-    memset(cmd, 0, sizeof(*cmd));
-    cmd->type = LIST;
-    cmd->left = left;
-    cmd->right = right;
-    return (struct cmd*)cmd;
-}
-
-// Construye una estructura de ejecución que incluye una ejecución en
-// segundo plano.
-struct cmd*
-backcmd(struct cmd *subcmd)
-{
-    struct backcmd *cmd;
-
-    cmd = malloc(sizeof(*cmd));
-    memset(cmd, 0, sizeof(*cmd));
-    cmd->type = BACK;
-    cmd->cmd = subcmd;
-    return (struct cmd*)cmd;
-}
-
-// Parsing
-// ----
-
-const char whitespace[] = " \t\r\n\v";
-const char symbols[] = "<|>&;()";
-
-// Obtiene un *token* de la cadena de entrada `ps`, y hace que `q` apunte a
-// él (si no es `NULL`).
-int
-gettoken(char **ps, char *end_of_str, char **q, char **eq)
-{
-    char *s;
-    int ret;
-
-    s = *ps;
-    while (s < end_of_str && strchr(whitespace, *s))
-        s++;
-    if (q)
-        *q = s;
-    ret = *s;
-    switch (*s)
-    {
-    case 0:
-        break;
-    case '|':
-    case '(':
-    case ')':
-    case ';':
-    case '&':
-    case '<':
-        s++;
-        break;
-    case '>':
-        s++;
-        if (*s == '>')
-        {
-            ret = '+';
-            s++;
-        }
-        break;
-
-    default:
-        // El caso por defecto (no hay caracteres especiales) es el de un
-        // argumento de programa. Se retorna el valor `'a'`, `q` apunta al
-        // mismo (si no era `NULL`), y `ps` se avanza hasta que salta todos
-        // los espacios **después** del argumento. `eq` se hace apuntar a
-        // donde termina el argumento. Así, si `ret` es `'a'`:
-        //
-        //     |-----------+---+---+---+---+---+---+---+---+---+-----------|
-        //     | (espacio) | a | r | g | u | m | e | n | t | o | (espacio) |
-        //     |-----------+---+---+---+---+---+---+---+---+---+-----------|
-        //                   ^                                   ^
-        //                   |q                                  |eq
-        //
-        ret = 'a';
-        while (s < end_of_str && !strchr(whitespace, *s) && !strchr(symbols, *s))
-            s++;
-        break;
-    }
-
-    // Apuntar `eq` (si no es `NULL`) al final del argumento.
-    if (eq)
-        *eq = s;
-
-    // Y finalmente saltar los espacios en blanco y actualizar `ps`.
-    while(s < end_of_str && strchr(whitespace, *s))
-        s++;
-    *ps = s;
-
-    return ret;
-}
-
-// La función `peek()` recibe un puntero a una cadena, `ps`, y un final de
-// cadena, `end_of_str`, y un conjunto de tokens (`toks`). El puntero
-// pasado, `ps`, es llevado hasta el primer carácter que no es un espacio y
-// posicionado ahí. La función retorna distinto de `NULL` si encuentra el
-// conjunto de caracteres pasado en `toks` justo después de los posibles
-// espacios.
-int
-peek(char **ps, char *end_of_str, char *toks)
-{
-    char *s;
-
-    s = *ps;
-    while(s < end_of_str && strchr(whitespace, *s))
-        s++;
-    *ps = s;
-
-    return *s && strchr(toks, *s);
-}
-
-// Definiciones adelantadas de funciones.
-struct cmd *parse_line(char**, char*);
-struct cmd *parse_pipe(char**, char*);
-struct cmd *parse_exec(char**, char*);
-struct cmd *nulterminate(struct cmd*);
-
-// Función principal que hace el *parsing* de una línea de órdenes dada por
-// el usuario. Llama a la función `parse_line()` para obtener la estructura
-// `cmd`.
-struct cmd*
-parse_cmd(char *s)
-{
-    char *end_of_str;
-    struct cmd *cmd;
-
-    end_of_str = s + strlen(s);
-    cmd = parse_line(&s, end_of_str);
-
-    peek(&s, end_of_str, "");
-    if (s != end_of_str)
-    {
-        fprintf(stderr, "restante: %s\n", s);
-        panic("syntax");
-    }
-
-    // Termina en `'\0'` todas las cadenas de caracteres de `cmd`.
-    nulterminate(cmd);
-
-    return cmd;
-}
-
-// *Parsing* de una línea. Se comprueba primero si la línea contiene alguna
-// tubería. Si no, puede ser un comando en ejecución con posibles
-// redirecciones o un bloque. A continuación puede especificarse que se
-// ejecuta en segundo plano (con `&`) o simplemente una lista de órdenes
-// (con `;`).
-struct cmd*
-parse_line(char **ps, char *end_of_str)
-{
-    struct cmd *cmd;
-
-    cmd = parse_pipe(ps, end_of_str);
-    while (peek(ps, end_of_str, "&"))
-    {
-        gettoken(ps, end_of_str, 0, 0);
-        cmd = backcmd(cmd);
-    }
-
-    if (peek(ps, end_of_str, ";"))
-    {
-        gettoken(ps, end_of_str, 0, 0);
-        cmd = listcmd(cmd, parse_line(ps, end_of_str));
-    }
-
-    return cmd;
-}
-
-// *Parsing* de una posible tubería con un número de órdenes.
-// `parse_exec()` comprobará la orden, y si al volver el siguiente *token*
-// es un `'|'`, significa que se puede ir construyendo una tubería.
-struct cmd*
-parse_pipe(char **ps, char *end_of_str)
-{
-    struct cmd *cmd;
-
-    cmd = parse_exec(ps, end_of_str);
-    if (peek(ps, end_of_str, "|"))
-    {
-        gettoken(ps, end_of_str, 0, 0);
-        cmd = pipecmd(cmd, parse_pipe(ps, end_of_str));
-    }
-
-    return cmd;
-}
-
-
-// Construye los comandos de redirección si encuentra alguno de los
-// caracteres de redirección.
-struct cmd*
-parse_redirs(struct cmd *cmd, char **ps, char *end_of_str)
-{
-    int tok;
-    char *q, *eq;
-
-    // Si lo siguiente que hay a continuación es una redirección...
-    while (peek(ps, end_of_str, "<>"))
-    {
-        // La elimina de la entrada
-        tok = gettoken(ps, end_of_str, 0, 0);
-
-        // Si es un argumento, será el nombre del fichero de la
-        // redirección. `q` y `eq` tienen su posición.
-        if (gettoken(ps, end_of_str, &q, &eq) != 'a')
-            panic("missing file for redirection");
-
-        switch(tok)
-        {
-        case '<':
-            cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
-            break;
-        // Boletin 2, ejercicio 1. Añadimos los flags para que la semántica de las
-        // redirecciones sea la misma que en bash.
-        case '>':
-            cmd = redircmd(cmd, q, eq, O_RDWR|O_CREAT|O_TRUNC, 1);
-            break;
-        case '+':  // >>
-            cmd = redircmd(cmd, q, eq, O_RDWR|O_CREAT|O_APPEND, 1);
-            break;
-        }
-    }
-
-    return cmd;
-}
-
-// *Parsing* de un bloque de órdenes delimitadas por paréntesis.
-struct cmd*
-parse_block(char **ps, char *end_of_str)
-{
-    struct cmd *cmd;
-
-    // Esperar e ignorar el paréntesis
-    if (!peek(ps, end_of_str, "("))
-        panic("parse_block");
-    gettoken(ps, end_of_str, 0, 0);
-
-    // Parse de toda la línea hsta el paréntesis de cierre
-    cmd = parse_line(ps, end_of_str);
-
-    // Elimina el paréntesis de cierre
-    if (!peek(ps, end_of_str, ")"))
-        panic("syntax - missing )");
-    gettoken(ps, end_of_str, 0, 0);
-
-    // ¿Posibles redirecciones?
-    cmd = parse_redirs(cmd, ps, end_of_str);
-
-    return cmd;
-}
-
-// Hace en *parsing* de una orden, a no ser que la expresión comience por
-// un paréntesis. En ese caso, se inicia un grupo de órdenes para ejecutar
-// las órdenes de dentro del paréntesis (llamando a `parse_block()`).
-struct cmd*
-parse_exec(char **ps, char *end_of_str)
-{
-    char *q, *eq;
-    int tok, argc;
-    struct execcmd *cmd;
-    struct cmd *ret;
-
-    // ¿Inicio de un bloque?
-    if (peek(ps, end_of_str, "("))
-        return parse_block(ps, end_of_str);
-
-    // Si no, lo primero que hay una línea siempre es una orden. Se
-    // construye el `cmd` usando la estructura `execcmd`.
-    ret = execcmd();
-    cmd = (struct execcmd*)ret;
-
-    // Bucle para separar los argumentos de las posibles redirecciones.
-    argc = 0;
-    ret = parse_redirs(ret, ps, end_of_str);
-    while (!peek(ps, end_of_str, "|)&;"))
-    {
-        if ((tok=gettoken(ps, end_of_str, &q, &eq)) == 0)
-            break;
-
-        // Aquí tiene que reconocerse un argumento, ya que el bucle para
-        // cuando hay un separador
-        if (tok != 'a')
-            panic("syntax");
-
-        // Apuntar el siguiente argumento reconocido. El primero será la
-        // orden a ejecutar.
-        cmd->argv[argc] = q;
-        cmd->eargv[argc] = eq;
-        argc++;
-        if (argc >= MAXARGS)
-            panic("too many args");
-
-        // Y de nuevo apuntar posibles redirecciones
-        ret = parse_redirs(ret, ps, end_of_str);
-    }
-
-    // Finalizar las líneas de órdenes
-    cmd->argv[argc] = 0;
-    cmd->eargv[argc] = 0;
-
-    return ret;
-}
-
-// Termina en NUL todas las cadenas de `cmd`.
-struct cmd*
-nulterminate(struct cmd *cmd)
-{
-    int i;
-    struct backcmd *bcmd;
-    struct execcmd *ecmd;
-    struct listcmd *lcmd;
-    struct pipecmd *pcmd;
-    struct redircmd *rcmd;
-
-    if(cmd == 0)
-        return 0;
-
-    switch(cmd->type)
-    {
-    case EXEC:
-        ecmd = (struct execcmd*)cmd;
-        for(i=0; ecmd->argv[i]; i++)
-            *ecmd->eargv[i] = 0;
-        break;
-
-    case REDIR:
-        rcmd = (struct redircmd*)cmd;
-        nulterminate(rcmd->cmd);
-        *rcmd->efile = 0;
-        break;
-
-    case PIPE:
-        pcmd = (struct pipecmd*)cmd;
-        nulterminate(pcmd->left);
-        nulterminate(pcmd->right);
-        break;
-
-    case LIST:
-        lcmd = (struct listcmd*)cmd;
-        nulterminate(lcmd->left);
-        nulterminate(lcmd->right);
-        break;
-
-    case BACK:
-        bcmd = (struct backcmd*)cmd;
-        nulterminate(bcmd->cmd);
-        break;
-    }
-
-    return cmd;
-}
-
-/*
- * Local variables:
- * mode: c
- * c-basic-offset: 4
- * fill-column: 75
- * eval: (auto-fill-mode t)
- * End:
+/*
+    GRUPO 1.2
+    Antonio Saavedra Sanchez
+    Jorge Gallego Madrid
+*/
+
+
+// Shell `simplesh`
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <stddef.h>
+#include <pwd.h>
+#include <libgen.h>
+#include <getopt.h>
+#include <ftw.h>
+#include <dirent.h>
+#include <search.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <poll.h>
+#include <time.h>
+#include <spawn.h>
+#include <pthread.h>
+
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/epoll.h>
+#include <linux/io_uring.h>
+#if defined(__SSE2__) && defined(__OPTIMIZE__)
+#include <emmintrin.h>
+#endif
+
+// Libreadline
+#include <readline/readline.h>
+#include <readline/history.h>
+
+
+// Tipos presentes en la estructura `cmd`, campo `type`.
+#define EXEC  1
+#define REDIR 2
+#define PIPE  3
+#define LIST  4
+#define BACK  5
+
+#define ARGVSIZE 8
+#define MAXPATH 256
+#define TEEBUFSIZE (1 << 20)
+#define WBSIZE (8 << 20)
+#define SCRIPTSIZE 4096
+#define ARENASIZE 4096
+#define MAXREDIRS 16
+#define HASHSIZE 64
+#define PCACHESIZE 512
+#define PCACHE_ENTRIES 256
+#define DU_RINGSIZE 256
+#define DU_DENTSIZE 32768
+#define DU_PREFIX 4096
+#define DU_HASHBUF (1 << 20)
+
+// Timeout inicial de simplesh
+#define INITIAL_TIMEOUT 5
+
+// Flags para el open en tee
+#define AOPENFLAGS O_WRONLY|O_APPEND|O_CREAT
+#define OPENFLAGS O_WRONLY|O_TRUNC|O_CREAT
+
+// Estructuras
+// -----
+
+// La estructura `cmd` se utiliza para almacenar la información que
+// servirá al shell para guardar la información necesaria para
+// ejecutar las diferentes tipos de órdenes (tuberías, redirecciones,
+// etc.)
+//
+// El formato es el siguiente:
+//
+//     |----------+--------------+--------------|
+//     | (1 byte) | ...          | ...          |
+//     |----------+--------------+--------------|
+//     | type     | otros campos | otros campos |
+//     |----------+--------------+--------------|
+//
+// Nótese cómo las estructuras `cmd` comparten el primer campo `type`
+// para identificar el tipo de la estructura, y luego se obtendrá un
+// tipo derivado a través de *casting* forzado de tipo. Se obtiene así
+// un polimorfismo básico en C.
+struct cmd {
+    int type;
+};
+
+// Ejecución de un comando con sus parámetros. Los vectores están en la
+// arena y crecen según hace falta (ver `execcmd_push()`); `argv` termina
+// en NULL y se pasa tal cual a `exec`.
+struct execcmd {
+    int type;
+    int argc;
+    int cap;        // Capacidad de `argv` y `eargv`, contando el NULL
+    char ** argv;
+    char ** eargv;
+};
+
+// Ejecución de un comando de redirección
+struct redircmd {
+    int type;
+    struct cmd *cmd;
+    char *file;
+    char *efile;
+    int mode;
+    int fd;
+};
+
+// Ejecución de un comando de tubería
+struct pipecmd {
+    int type;
+    struct cmd *left;
+    struct cmd *right;
+};
+
+// Lista de órdenes
+struct listcmd {
+    int type;
+    struct cmd *left;
+    struct cmd *right;
+};
+
+// Tarea en segundo plano (background) con `&`.
+struct backcmd {
+    int type;
+    struct cmd *cmd;
+};
+
+// Memoria de las órdenes
+// -----
+
+// Todos los nodos `cmd` de una línea se reservan en una zona (*arena*)
+// con asignación por desplazamiento. Al terminar de ejecutar la línea se
+// libera todo de una vez con `arena_reset()`, en vez de perder los
+// `malloc` de cada constructor.
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+    size_t used;
+    max_align_t data[];
+};
+
+static struct arena_chunk *arena = NULL;
+// Cada línea cuenta como un parse, tanto si se analiza como si se
+// reconstruye desde la caché de `parse_cached()`.
+static size_t arena_parse_bytes = 0; // Bytes pedidos en el último parse
+static size_t arena_max_bytes = 0;   // Máximo de bytes de un parse
+static size_t arena_total_bytes = 0; // Suma de bytes de todos los parse
+static size_t arena_parses = 0;      // Número de parse realizados
+
+// Reserva `n` bytes a cero en la arena. Si no caben en el bloque actual
+// se encadena uno nuevo de, al menos, el doble de tamaño.
+void* arena_alloc(size_t n){
+    n = (n + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1);
+    if (arena == NULL || arena->size - arena->used < n){
+        size_t size = arena ? arena->size * 2 : ARENASIZE;
+        while (size < n)
+            size *= 2;
+        struct arena_chunk *chunk = malloc(sizeof(*chunk) + size);
+        if (chunk == NULL){
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        chunk->next = arena;
+        chunk->size = size;
+        chunk->used = 0;
+        arena = chunk;
+    }
+    void *p = (char*)arena->data + arena->used;
+    arena->used += n;
+    arena_parse_bytes += n;
+    memset(p, 0, n);
+    return p;
+}
+
+// Empieza a contar los bytes del árbol de una línea.
+void arena_parse_start(void){
+    arena_parse_bytes = 0;
+}
+
+// Suma a las estadísticas los bytes del árbol de la línea.
+void arena_parse_end(void){
+    arena_parses++;
+    arena_total_bytes += arena_parse_bytes;
+    if (arena_parse_bytes > arena_max_bytes)
+        arena_max_bytes = arena_parse_bytes;
+}
+
+// Libera de una vez todo lo reservado para una línea. Se conserva el
+// bloque más reciente (el mayor) para que, en régimen estable, no haya
+// que volver a llamar a `malloc`.
+void arena_reset(void){
+    if (arena == NULL)
+        return;
+    struct arena_chunk *chunk = arena->next;
+    while (chunk){
+        struct arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->next = NULL;
+    arena->used = 0;
+}
+
+// Comando interno `arena`: muestra los bytes reservados por parse para
+// comprobar que la memoria del shell no crece con el número de órdenes.
+void run_arena(){
+    size_t reserved = 0;
+    for (struct arena_chunk *chunk = arena; chunk; chunk = chunk->next)
+        reserved += sizeof(*chunk) + chunk->size;
+    fprintf(stdout, "parses: %zu\n", arena_parses);
+    fprintf(stdout, "bytes último parse: %zu\n", arena_parse_bytes);
+    fprintf(stdout, "bytes medios por parse: %zu\n",
+            arena_parses ? arena_total_bytes / arena_parses : 0);
+    fprintf(stdout, "bytes máximos por parse: %zu\n", arena_max_bytes);
+    fprintf(stdout, "bytes reservados: %zu\n", reserved);
+}
+
+// Entorno que se pasa a las órdenes lanzadas con posix_spawn.
+extern char **environ;
+
+// Declaración de funciones necesarias
+int fork1(void);  // Fork but panics on failure.
+void panic(char*);
+void run_cmd(struct cmd*);
+struct cmd *parse_cmd(char*);
+void execcmd_push(struct execcmd*, char*, char*);
+struct cmd *execcmd(void);
+struct cmd *redircmd(struct cmd*, char*, char*, int, int);
+struct cmd *pipecmd(struct cmd*, struct cmd*);
+struct cmd *listcmd(struct cmd*, struct cmd*);
+struct cmd *backcmd(struct cmd*);
+
+// Boletin 2, ejercicio 3. Función para implementar el comando pwd como un comando interno.
+int run_pwd(){
+    char path[MAXPATH];
+    // Obtenemos el path actual.
+    char * ruta = getcwd(path, MAXPATH);
+    if (ruta == NULL){
+        perror("getcwd");
+        return EXIT_FAILURE;
+    }
+    fprintf(stderr, "simplesh: pwd: ");
+    fprintf(stdout, "%s\n", ruta);
+    return 0;
+}
+
+
+// Boletin 2, ejercicio 5. Función para implementar el comando cd como un comando interno.
+void run_cd(struct cmd *command){
+    struct execcmd *comm = (struct execcmd*)command;
+    char *route;
+    // Si no se le pasa argumento se cambia al directorio home
+    if (comm->argv[1] == NULL)
+        route = getenv("HOME");
+    // Si se recibe, se cambia al directorio indicado como argumento.
+    else
+        route = comm->argv[1];
+    if (chdir(route) == -1){
+        perror("cd");
+        // Tratamos errores del cd y solo nos salimos si no es alguno de los errores 
+        // indicados, ya que éstos no son fatales y la ejecución puede continuar sin
+        // ningún problema.
+        if (errno != ENOENT && errno != EACCES && errno != ENOTDIR)
+            exit(EXIT_FAILURE);
+    }
+    return;
+    
+}
+
+// Lee un tamaño en bytes con signo y sufijo opcional K, M, G, T, P o E
+// (potencias de 1024), como `-t 10G` o `-t -512K`. Retorna -1 si la
+// cadena no es válida o el valor no cabe en 64 bits.
+int parse_size(const char *str, long long *out){
+    const char *suffixes = "KMGTPE";
+    char *end;
+    errno = 0;
+    long long value = strtoll(str, &end, 10);
+    if (end == str || errno == ERANGE)
+        return -1;
+    if (*end != '\0'){
+        const char *unit = strchr(suffixes, *end >= 'a' ? *end - 'a' + 'A' : *end);
+        if (unit == NULL || end[1] != '\0')
+            return -1;
+        for (int i = 0; i <= unit - suffixes; i++){
+            if (value > LLONG_MAX / 1024 || value < LLONG_MIN / 1024)
+                return -1;
+            value *= 1024;
+        }
+    }
+    *out = value;
+    return 0;
+}
+
+// Boletin 3, opcional. Comando tee añade una línea al fichero $HOME/.tee.log.
+void print_teelog(long long bytes, int files){
+    int pid, euid;
+    struct timeval tv;
+    time_t tm;
+    char tmbuf[20];
+    pid = getpid();
+    euid = geteuid();
+    
+    if(gettimeofday(&tv, NULL) == -1)
+        perror("gettimeofday");
+    else{
+        // Obtenemos fecha y hora
+        tm = tv.tv_sec;
+        struct tm * tiempo = localtime(&tm);
+        strftime(tmbuf, sizeof tmbuf, "%Y-%m-%d %H:%M:%S", tiempo);
+        // Guardamos en output la línea a escribir.
+        char output[128];
+        int chars = snprintf(output, sizeof output, "%s:PID %d:EUID %d:%lld byte(s):%d file(s)\n", tmbuf, pid, euid, bytes, files);
+        char* file = "/.tee.log";
+        char * home = getenv("HOME");
+        char path[MAXPATH];
+        snprintf(path, MAXPATH, "%s%s", home, file);
+        // Abrimos el fichero en modo append
+        int descr = open(path, AOPENFLAGS, S_IRWXU);        
+        if (descr != -1){
+           if(write(descr, output, chars) == -1)
+            perror("write");
+           close(descr);
+        }
+        else
+            perror("open");
+    }
+}
+
+// Escribe los `n` bytes de `buf` en `fd`, reintentando las escrituras
+// parciales. Retorna -1 si falla.
+int write_all(int fd, char *buf, size_t n){
+    while (n > 0){
+        ssize_t w = write(fd, buf, n);
+        if (w == -1){
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += w;
+        n -= w;
+    }
+    return 0;
+}
+
+// Mueve exactamente `n` bytes de la tubería `in` a `out` con splice(2).
+int splice_all(int in, int out, size_t n){
+    while (n > 0){
+        ssize_t m = splice(in, NULL, out, NULL, n, SPLICE_F_MOVE);
+        if (m <= 0){
+            if (m == -1 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        n -= m;
+    }
+    return 0;
+}
+
+// Intenta ampliar la tubería `p` a `want` bytes y retorna el tamaño de
+// bloque que se puede usar con ella.
+size_t pipe_capacity(int p[2], size_t want){
+    fcntl(p[1], F_SETPIPE_SZ, (int) want);
+    int cap = fcntl(p[1], F_GETPIPE_SZ);
+    return cap > 0 && (size_t) cap < want ? (size_t) cap : want;
+}
+
+// Modos de persistencia de los ficheros de tee (opción -s).
+#define TEE_SYNC_NONE 0 // No se fuerza la escritura a disco
+#define TEE_SYNC_DATA 1 // fdatasync al terminar
+#define TEE_SYNC_FULL 2 // fsync al terminar (por defecto)
+#define TEE_SYNC_WB   3 // sync_file_range durante la copia y fdatasync al terminar
+
+// Estado de la escritura diferida (modo `wb`) de los ficheros de tee.
+struct writebehind {
+    int n;          // Número de ficheros
+    int *fd;        // Descriptores (-1 si no se pudo abrir)
+    off_t *base;    // Desplazamiento en el que empieza la copia
+    long long done; // Bytes ya enviados a disco en cada fichero
+};
+
+// Lanza la escritura de cada ventana completa de WBSIZE bytes en cuanto
+// se ha copiado, y espera a la ventana anterior. Así no se acumulan más
+// de dos ventanas de páginas sucias por fichero y el fdatasync final
+// apenas tiene trabajo.
+void writebehind(struct writebehind *wb, long long total){
+    while (total - wb->done >= WBSIZE){
+        for (int i = 0; i < wb->n; i++){
+            if (wb->fd[i] == -1)
+                continue;
+            sync_file_range(wb->fd[i], wb->base[i] + wb->done, WBSIZE,
+                            SYNC_FILE_RANGE_WRITE);
+            if (wb->done >= WBSIZE)
+                sync_file_range(wb->fd[i], wb->base[i] + wb->done - WBSIZE, WBSIZE,
+                                SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE
+                                | SYNC_FILE_RANGE_WAIT_AFTER);
+        }
+        wb->done += WBSIZE;
+    }
+}
+
+// Fuerza a disco el fichero `fd` según el modo `mode`.
+int tee_flush(int fd, int mode){
+    if (mode == TEE_SYNC_FULL && fsync(fd) == -1){
+        perror("fsync");
+        return -1;
+    }
+    if ((mode == TEE_SYNC_DATA || mode == TEE_SYNC_WB) && fdatasync(fd) == -1){
+        perror("fdatasync");
+        return -1;
+    }
+    return 0;
+}
+
+struct teeflush {
+    int fd;
+    int mode;
+};
+
+void* tee_flush_thread(void *arg){
+    struct teeflush *tf = arg;
+    tee_flush(tf->fd, tf->mode);
+    return NULL;
+}
+
+// Fuerza a disco los `n` ficheros de `fd`, uno tras otro o, con
+// `parallel`, todos a la vez con un hilo por fichero.
+void tee_flush_all(int *fd, int n, int mode, int parallel){
+    if (mode == TEE_SYNC_NONE)
+        return;
+    if (!parallel){
+        for (int i = 0; i < n; i++)
+            if (fd[i] != -1)
+                tee_flush(fd[i], mode);
+        return;
+    }
+    pthread_t th[n];
+    struct teeflush tf[n];
+    int started[n];
+    for (int i = 0; i < n; i++){
+        started[i] = 0;
+        if (fd[i] == -1)
+            continue;
+        tf[i].fd = fd[i];
+        tf[i].mode = mode;
+        // Si no se puede crear el hilo, se sincroniza en este.
+        if (pthread_create(&th[i], NULL, tee_flush_thread, &tf[i]) == 0)
+            started[i] = 1;
+        else
+            tee_flush(fd[i], mode);
+    }
+    for (int i = 0; i < n; i++)
+        if (started[i])
+            pthread_join(th[i], NULL);
+}
+
+// Indica si la copia puede hacerse en el núcleo: la entrada ha de ser una
+// tubería o un fichero regular y cada salida una tubería o un fichero
+// regular abierto sin O_APPEND (splice(2) no admite ese modo).
+int tee_can_splice(int *out, int nout){
+    struct stat st;
+    if (fstat(STDIN_FILENO, &st) == -1 || !(S_ISFIFO(st.st_mode) || S_ISREG(st.st_mode)))
+        return 0;
+    for (int i = 0; i < nout; i++){
+        if (fstat(out[i], &st) == -1)
+            return 0;
+        if (S_ISREG(st.st_mode)){
+            int fl = fcntl(out[i], F_GETFL);
+            if (fl == -1 || (fl & O_APPEND))
+                return 0;
+        }
+        else if (!S_ISFIFO(st.st_mode))
+            return 0;
+    }
+    return 1;
+}
+
+// Descarta `n` bytes de la tubería `in`. Retorna -1 si falla.
+int tee_discard(int in, size_t n){
+    char buf[16384];
+    while (n > 0){
+        ssize_t r = read(in, buf, n < sizeof(buf) ? n : sizeof(buf));
+        if (r <= 0){
+            if (r == -1 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        n -= r;
+    }
+    return 0;
+}
+
+// Copia stdin en las salidas `out` sin pasar los datos por espacio de
+// usuario. En cada bloque, las salidas salvo la última reciben una copia
+// con tee(2) en una tubería intermedia propia, que se vacía con splice(2);
+// la última consume la entrada directamente con splice(2). Si la entrada
+// es un fichero, antes se lleva el bloque a una tubería. Como en
+// `tee_copy()`, una salida que falla deja de usarse (queda a -1): si es
+// la última, el resto de cada bloque se lee y se descarta. Retorna los
+// bytes copiados, o -1 si falló la entrada o una tubería intermedia.
+long long tee_splice(int *out, int nout, size_t chunk, struct writebehind *wb){
+    int in = STDIN_FILENO;
+    int inpipe[2] = {-1, -1};
+    int stage[nout][2];
+    int last = nout - 1;
+    long long total = 0;
+    int error = 0;
+    struct stat st;
+
+    for (int i = 0; i < nout; i++)
+        stage[i][0] = stage[i][1] = -1;
+    fstat(STDIN_FILENO, &st);
+    if (!S_ISFIFO(st.st_mode)){
+        if (pipe(inpipe) == -1){
+            perror("pipe");
+            return -1;
+        }
+        chunk = pipe_capacity(inpipe, chunk);
+        in = inpipe[0];
+    }
+    for (int i = 0; i < last && !error; i++){
+        if (pipe(stage[i]) == -1){
+            perror("pipe");
+            error = 1;
+        }
+        else
+            chunk = pipe_capacity(stage[i], chunk);
+    }
+
+    while (!error){
+        // `n` es una cota hasta que la primera operación del bloque fija
+        // cuántos bytes hay disponibles en la entrada.
+        ssize_t n = chunk;
+        int known = 0;
+        if (inpipe[0] != -1){
+            if ((n = splice(STDIN_FILENO, NULL, inpipe[1], NULL, chunk, SPLICE_F_MOVE)) <= 0){
+                if (n == -1 && errno == EINTR)
+                    continue;
+                if (n == -1){
+                    perror("splice");
+                    error = 1;
+                }
+                break;
+            }
+            known = 1;
+        }
+        for (int i = 0; i < last && !error; i++){
+            if (out[i] == -1)
+                continue;
+            ssize_t r = tee(in, stage[i][1], n, 0);
+            if (r == -1 && errno == EINTR){
+                i--;
+                continue;
+            }
+            if (r == -1 || (known && r != n)){
+                perror("tee");
+                error = 1;
+                break;
+            }
+            if (!known){
+                if (r == 0)
+                    goto done;
+                n = r;
+                known = 1;
+            }
+            // Al cerrar su tubería intermedia se descarta lo que quede.
+            if (splice_all(stage[i][0], out[i], r) == -1){
+                perror("splice");
+                close(stage[i][0]);
+                close(stage[i][1]);
+                stage[i][0] = stage[i][1] = -1;
+                out[i] = -1;
+            }
+        }
+        if (error)
+            break;
+        // Lo que la última salida no consume del bloque.
+        size_t left = known ? n : 0;
+        if (out[last] != -1 && known){
+            while (left > 0){
+                ssize_t m = splice(in, NULL, out[last], NULL, left, SPLICE_F_MOVE);
+                if (m == -1 && errno == EINTR)
+                    continue;
+                if (m <= 0){
+                    perror("splice");
+                    out[last] = -1;
+                    break;
+                }
+                left -= m;
+            }
+        }
+        else if (out[last] != -1){
+            ssize_t m = splice(in, NULL, out[last], NULL, n, SPLICE_F_MOVE);
+            if (m == -1 && errno == EINTR)
+                continue;
+            if (m == 0)
+                break;
+            if (m == -1){
+                perror("splice");
+                out[last] = -1;
+            }
+            else{
+                n = m;
+                known = 1;
+            }
+        }
+        if (!known){
+            // Ninguna salida ha fijado el tamaño del bloque.
+            char buf[16384];
+            n = read(in, buf, (size_t) n < sizeof(buf) ? (size_t) n : sizeof(buf));
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n <= 0){
+                if (n == -1){
+                    perror("read");
+                    error = 1;
+                }
+                break;
+            }
+        }
+        else if (left > 0 && tee_discard(in, left) == -1){
+            perror("read");
+            error = 1;
+            break;
+        }
+        total += n;
+        if (wb)
+            writebehind(wb, total);
+    }
+
+done:
+    for (int i = 0; i < last; i++){
+        if (stage[i][0] != -1){
+            close(stage[i][0]);
+            close(stage[i][1]);
+        }
+    }
+    if (inpipe[0] != -1){
+        close(inpipe[0]);
+        close(inpipe[1]);
+    }
+    return error ? -1 : total;
+}
+
+// Copia stdin en las salidas `out` con read/write y un buffer de `bufsize`
+// bytes. Una salida que falla deja de usarse. Retorna los bytes leídos.
+// En ambas copias, si `wb` no es `NULL` se hace escritura diferida.
+long long tee_copy(int *out, int nout, size_t bufsize, struct writebehind *wb){
+    char *buf = malloc(bufsize);
+    long long total = 0;
+    ssize_t n;
+    if (buf == NULL){
+        perror("malloc");
+        return -1;
+    }
+    while ((n = read(STDIN_FILENO, buf, bufsize)) != 0){
+        if (n == -1){
+            if (errno == EINTR)
+                continue;
+            perror("read");
+            break;
+        }
+        total += n;
+        for (int i = 0; i < nout; i++){
+            if (out[i] != -1 && write_all(out[i], buf, n) == -1){
+                perror("write");
+                out[i] = -1;
+            }
+        }
+        if (wb)
+            writebehind(wb, total);
+    }
+    free(buf);
+    return total;
+}
+
+// Boletin 3, ejercicio 1. Función para implementar el comando tee como un comando interno
+int run_tee(struct execcmd* ecmd){
+    int cont = ecmd->argc;
+    int opt;
+    int aflag = 0;
+    int hflag = 0;
+    int vflag = 0;
+    int pflag = 0;
+    int syncmode = TEE_SYNC_FULL;
+    long long bufsize = TEEBUFSIZE;
+    // Procesamos los parámetros. Reiniciamos getopt porque la orden
+    // puede ejecutarse varias veces en el mismo proceso.
+    optind = 0;
+    while ((opt = getopt(cont, ecmd->argv, "havb:s:p")) != -1){
+        switch (opt){
+            case 'h':
+                hflag = 1;
+                break;
+            case 'a':
+                aflag = 1;
+                break;
+            case 'v':
+                vflag = 1;
+                break;
+            case 'b':
+                if (parse_size(optarg, &bufsize) == -1 || bufsize <= 0 || bufsize > INT_MAX)
+                    hflag = 1;
+                break;
+            case 's':
+                if (strcmp(optarg, "none") == 0)
+                    syncmode = TEE_SYNC_NONE;
+                else if (strcmp(optarg, "data") == 0)
+                    syncmode = TEE_SYNC_DATA;
+                else if (strcmp(optarg, "full") == 0)
+                    syncmode = TEE_SYNC_FULL;
+                else if (strcmp(optarg, "wb") == 0)
+                    syncmode = TEE_SYNC_WB;
+                else
+                    hflag = 1;
+                break;
+            case 'p':
+                pflag = 1;
+                break;
+            case '?':
+                hflag = 1;
+                break;
+        }
+    }
+    
+    // Si se encuentra la opción h o no se reconoce alguna de las que se introducen,
+    // se muestra la ayuda y se ignoran el resto de opciones.
+    if (hflag){
+        fprintf(stdout, "Uso: tee [-h] [-a] [-v] [-p] [-b BYTES] [-s MODO] [FICHERO]\n"\
+                            "\tCopia stdin a cada FICHERO y a stdout\n"\
+                            "\tOpciones:\n"\
+                            "\t-a Añade al final de cada FICHERO\n"\
+                            "\t-v Muestra los bytes copiados y el método usado\n"\
+                            "\t-b BYTES Tamaño de bloque de la copia\n"\
+                            "\t-s MODO Persistencia de los ficheros: none, data (fdatasync),\n"\
+                                "\t\tfull (fsync, por defecto) o wb (escritura diferida\n"\
+                                "\t\tcon sync_file_range durante la copia y fdatasync)\n"\
+                            "\t-p Sincroniza todos los ficheros a la vez\n"\
+                            "\t-h help\n");
+    }
+    else{
+        // Calculamos el número de ficheros que se pasan como argumento
+        int numFich = cont-optind;
+        int descriptor[numFich];
+        int flag;
+        // Definimos los flags del open en funcion de la opción -a, si se encuentra
+        // usamos el O_APPEND, si no, O_TRUNC.
+        if (aflag)
+            flag = AOPENFLAGS;
+        else
+            flag = OPENFLAGS;
+        
+        // Abrimos los ficheros    
+        for (int i = 0; i < numFich; i++) {
+            descriptor[i] = open(ecmd->argv[i+optind], flag, S_IRWXU);
+            if(descriptor[i] == -1){
+                perror("open");
+            }
+        }
+
+        // Salidas de la copia: stdout y los ficheros abiertos con éxito.
+        // stdout va la última para que reciba los datos sin intermediarios
+        // cuando se usa splice.
+        int out[numFich + 1];
+        int nout = 0;
+        for (int i = 0; i < numFich; i++)
+            if (descriptor[i] != -1)
+                out[nout++] = descriptor[i];
+        out[nout++] = STDOUT_FILENO;
+
+        // En modo `wb` se necesita el desplazamiento inicial de cada fichero.
+        off_t base[numFich];
+        struct writebehind wb = { numFich, descriptor, base, 0 };
+        struct stat st;
+        for (int i = 0; i < numFich; i++)
+            base[i] = aflag && descriptor[i] != -1 && fstat(descriptor[i], &st) == 0 ? st.st_size : 0;
+
+        long long bytes;
+        int spliced = tee_can_splice(out, nout);
+        if (spliced)
+            bytes = tee_splice(out, nout, bufsize, syncmode == TEE_SYNC_WB ? &wb : NULL);
+        else
+            bytes = tee_copy(out, nout, bufsize, syncmode == TEE_SYNC_WB ? &wb : NULL);
+        if (bytes < 0)
+            bytes = 0;
+        if (vflag)
+            fprintf(stderr, "simplesh: tee: %lld byte(s), %s\n", bytes,
+                    spliced ? "splice" : "read/write");
+
+        // Nos aseguramos que los ficheros han sido escritos a disco, según
+        // el modo elegido.
+        tee_flush_all(descriptor, numFich, syncmode, pflag);
+        for (int i = 0; i < numFich; i++){
+            // Cerramos solo los ficheros que se pudieron abrir con éxito.
+            if (descriptor[i] != -1 && close(descriptor[i]) == -1)
+                perror("close");
+        }
+        print_teelog(bytes, numFich);
+    }
+    return 0;
+}
+
+// Variables globales static para la función auxiliar.
+static long long totalSize = 0;
+static int du_bflag = 0; // Tamaño en disco de los bloques
+static int du_vflag = 0; // Verbose, imprime el tamaño de todos
+static int du_tflag = 0; // Restriccion de tamaño
+static long long size = 0;
+
+// Indica si el fichero `sb` se contabiliza según la restricción -t.
+int du_keep(const struct stat *sb){
+    long long sizethreshold = du_tflag ? size : 0;
+    return !S_ISREG(sb->st_mode) || (sizethreshold > 0 && sb->st_size < sizethreshold)
+        // Sin negar el umbral, que puede ser LLONG_MIN.
+        || (sizethreshold < 0 && -(long long) sb->st_size < sizethreshold)
+        || sizethreshold == 0;
+}
+
+// Tamaño que aporta `sb` al total según la opción -b.
+long long du_size(const struct stat *sb){
+    return du_bflag ? (long long) sb->st_blocks*512 : (long long) sb->st_size;
+}
+
+// Enlaces duros de du
+// -----
+
+// Un fichero con varios enlaces duros sólo se cuenta la primera vez que
+// aparece. Los (st_dev, st_ino) de los ficheros con st_nlink > 1 se
+// guardan en una tabla hash de direccionamiento abierto con entradas de
+// 16 bytes: el dispositivo se guarda como índice en `du_devs`, que
+// tendrá muy pocos elementos, y cada entrada lleva los enlaces que faltan
+// por ver. Cuando se han visto todos, la entrada se borra, de modo que la
+// tabla sólo contiene los inodos con enlaces pendientes.
+struct du_link {
+    uint64_t ino;
+    uint32_t dev;  // Índice en du_devs
+    uint32_t left; // Enlaces que faltan por ver; 0 indica hueco libre
+};
+
+static int du_lflag = 0; // Cuenta cada enlace duro por separado
+static struct du_link *du_links = NULL;
+static size_t du_nlinks = 0;
+static size_t du_caplinks = 0;
+static dev_t *du_devs = NULL;
+static uint32_t du_ndevs = 0;
+static pthread_mutex_t du_links_lock = PTHREAD_MUTEX_INITIALIZER;
+
+size_t du_link_slot(uint64_t ino, uint32_t dev){
+    uint64_t h = ino ^ ((uint64_t) dev << 48);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h & (du_caplinks - 1);
+}
+
+uint32_t du_dev_index(dev_t dev){
+    for (uint32_t i = 0; i < du_ndevs; i++)
+        if (du_devs[i] == dev)
+            return i;
+    if ((du_devs = realloc(du_devs, (du_ndevs + 1) * sizeof(*du_devs))) == NULL){
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    du_devs[du_ndevs] = dev;
+    return du_ndevs++;
+}
+
+// Duplica la tabla y recoloca las entradas.
+void du_links_grow(void){
+    struct du_link *old = du_links;
+    size_t oldcap = du_caplinks;
+    du_caplinks = oldcap ? oldcap * 2 : 1024;
+    if ((du_links = calloc(du_caplinks, sizeof(*du_links))) == NULL){
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < oldcap; i++){
+        if (old[i].left == 0)
+            continue;
+        size_t j = du_link_slot(old[i].ino, old[i].dev);
+        while (du_links[j].left != 0)
+            j = (j + 1) & (du_caplinks - 1);
+        du_links[j] = old[i];
+    }
+    free(old);
+}
+
+// Borra la entrada `i` desplazando hacia atrás las que la siguen en su
+// secuencia de sondeo, para no dejar marcas de borrado.
+void du_links_remove(size_t i){
+    size_t j = i;
+    du_links[i].left = 0;
+    while (1){
+        j = (j + 1) & (du_caplinks - 1);
+        if (du_links[j].left == 0)
+            break;
+        size_t h = du_link_slot(du_links[j].ino, du_links[j].dev);
+        // Si `h` no está en (i, j] cíclicamente, la entrada puede ocupar i.
+        if ((j > i && (h <= i || h > j)) || (j < i && h <= i && h > j)){
+            du_links[i] = du_links[j];
+            du_links[j].left = 0;
+            i = j;
+        }
+    }
+    du_nlinks--;
+}
+
+// Indica si el fichero `sb` debe contarse: siempre, salvo que sea un
+// enlace duro de un inodo que ya se ha contado.
+int du_first_link(const struct stat *sb){
+    if (du_lflag || sb->st_nlink < 2)
+        return 1;
+    int first = 1;
+    pthread_mutex_lock(&du_links_lock);
+    uint32_t dev = du_dev_index(sb->st_dev);
+    if (2 * (du_nlinks + 1) > du_caplinks)
+        du_links_grow();
+    size_t i = du_link_slot(sb->st_ino, dev);
+    while (du_links[i].left != 0){
+        if (du_links[i].ino == sb->st_ino && du_links[i].dev == dev){
+            first = 0;
+            if (--du_links[i].left == 0)
+                du_links_remove(i);
+            break;
+        }
+        i = (i + 1) & (du_caplinks - 1);
+    }
+    if (first){
+        du_links[i].ino = sb->st_ino;
+        du_links[i].dev = dev;
+        du_links[i].left = sb->st_nlink - 1;
+        du_nlinks++;
+    }
+    pthread_mutex_unlock(&du_links_lock);
+    return first;
+}
+
+void du_links_free(void){
+    free(du_links);
+    free(du_devs);
+    du_links = NULL;
+    du_devs = NULL;
+    du_nlinks = du_caplinks = 0;
+    du_ndevs = 0;
+}
+
+// Ficheros más grandes de du (-n N)
+// -----
+
+// Se guardan los N ficheros (y, con -D, directorios) más grandes en un
+// montículo de mínimos de N elementos: la raíz es el menor de los
+// guardados y sólo se sustituye cuando llega uno mayor. La memoria es
+// O(N) aunque el árbol tenga millones de ficheros.
+struct du_top {
+    char *path;
+    long long size;
+    char type; // 'F' o 'D', como en la salida de du
+};
+
+static int du_ntop = 0;     // N de -n, 0 si no se usa
+static int du_topdirs = 0;  // -D: incluir también directorios
+static struct du_top *du_heap = NULL;
+static int du_nheap = 0;
+
+void du_heap_swap(int i, int j){
+    struct du_top tmp = du_heap[i];
+    du_heap[i] = du_heap[j];
+    du_heap[j] = tmp;
+}
+
+void du_heap_down(int i){
+    while (1){
+        int min = i, l = 2*i + 1, r = 2*i + 2;
+        if (l < du_nheap && du_heap[l].size < du_heap[min].size)
+            min = l;
+        if (r < du_nheap && du_heap[r].size < du_heap[min].size)
+            min = r;
+        if (min == i)
+            return;
+        du_heap_swap(i, min);
+        i = min;
+    }
+}
+
+// Propone `path` con tamaño `size` para la lista de los más grandes.
+void du_top_offer(const char *path, long long size, char type){
+    if (du_nheap < du_ntop){
+        int i = du_nheap++;
+        du_heap[i].path = strdup(path);
+        du_heap[i].size = size;
+        du_heap[i].type = type;
+        // Se sube el nuevo elemento hasta su sitio.
+        while (i > 0 && du_heap[(i - 1) / 2].size > du_heap[i].size){
+            du_heap_swap(i, (i - 1) / 2);
+            i = (i - 1) / 2;
+        }
+    }
+    else if (du_ntop > 0 && size > du_heap[0].size){
+        free(du_heap[0].path);
+        du_heap[0].path = strdup(path);
+        du_heap[0].size = size;
+        du_heap[0].type = type;
+        du_heap_down(0);
+    }
+}
+
+// Imprime los guardados de mayor a menor y vacía el montículo. Se
+// extrae siempre el mínimo, así que el vector queda ordenado de mayor a
+// menor de atrás hacia delante.
+void du_top_print(void){
+    int n = du_nheap;
+    while (du_nheap > 1){
+        du_heap_swap(0, du_nheap - 1);
+        du_nheap--;
+        du_heap_down(0);
+    }
+    for (int i = 0; i < n; i++){
+        fprintf(stdout, "(%c) %s: %lld\n", du_heap[i].type, du_heap[i].path, du_heap[i].size);
+        free(du_heap[i].path);
+    }
+    du_nheap = 0;
+}
+
+// Ficheros duplicados de du (-R)
+// -----
+
+// Durante el recorrido se apuntan todos los ficheros no vacíos con su
+// tamaño. Al final sólo se leen los que comparten tamaño con otro: primero
+// se resume su primer bloque y, entre los que siguen coincidiendo, el
+// contenido completo. Los resúmenes se calculan en varios hilos, que se
+// reparten los ficheros con un contador atómico, con lecturas grandes y
+// secuenciales. Como dos resúmenes iguales no garantizan el mismo
+// contenido, antes de imprimir un grupo se compara byte a byte cada
+// fichero con el primero. De cada grupo de ficheros iguales bastaría con
+// conservar uno, así que lo recuperable es el tamaño del resto.
+struct du_dup {
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    long long size;   // st_size, con el que se agrupa
+    long long usage;  // Lo que aporta al total (du_size)
+    uint64_t h1, h2;  // Resumen de 128 bits del contenido leído
+    int err;          // No se pudo leer
+};
+
+struct du_hashjob {
+    struct du_dup **items;
+    size_t n;
+    long long limit;  // Bytes a resumir de cada fichero (-1: todos)
+    atomic_size_t next;
+};
+
+static int du_rflag = 0;
+static struct du_dup *du_dups = NULL;
+static size_t du_ndups = 0;
+static size_t du_capdups = 0;
+
+void du_dup_add(const char *path, const struct stat *sb){
+    if (sb->st_size == 0)
+        return;
+    if (du_ndups == du_capdups){
+        du_capdups = du_capdups ? du_capdups * 2 : 1024;
+        if ((du_dups = realloc(du_dups, du_capdups * sizeof(*du_dups))) == NULL){
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    struct du_dup *d = &du_dups[du_ndups++];
+    d->path = strdup(path);
+    d->dev = sb->st_dev;
+    d->ino = sb->st_ino;
+    d->size = sb->st_size;
+    d->usage = du_size(sb);
+    d->h1 = d->h2 = 0;
+    d->err = 0;
+}
+
+static inline uint64_t du_rotl(uint64_t x, int r){
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t du_fmix(uint64_t k){
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+// Resume los primeros `limit` bytes de `d` (todos si es -1) con dos
+// cadenas de 64 bits al estilo de MurmurHash3.
+void du_hash_file(struct du_dup *d, long long limit, char *buf){
+    const uint64_t c1 = 0x87c37b91114253d5ULL, c2 = 0x4cf5ad432745937fULL;
+    uint64_t h1 = d->size, h2 = ~(uint64_t) d->size;
+    long long left = limit < 0 || limit > d->size ? d->size : limit;
+    int fd = open(d->path, O_RDONLY);
+    if (fd == -1){
+        d->err = 1;
+        return;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    while (left > 0){
+        ssize_t n = read(fd, buf, left < DU_HASHBUF ? left : DU_HASHBUF);
+        if (n <= 0){
+            if (n == -1 && errno == EINTR)
+                continue;
+            d->err = 1;
+            break;
+        }
+        left -= n;
+        // Se completa el último bloque de 16 bytes con ceros.
+        while (n % 16)
+            buf[n++] = 0;
+        for (ssize_t i = 0; i < n; i += 16){
+            uint64_t k1, k2;
+            memcpy(&k1, buf + i, 8);
+            memcpy(&k2, buf + i + 8, 8);
+            h1 ^= du_rotl(k1 * c1, 31) * c2;
+            h1 = (du_rotl(h1, 27) + h2) * 5 + 0x52dce729;
+            h2 ^= du_rotl(k2 * c2, 33) * c1;
+            h2 = (du_rotl(h2, 31) + h1) * 5 + 0x38495ab5;
+        }
+    }
+    close(fd);
+    h1 += h2;
+    h2 += h1;
+    d->h1 = du_fmix(h1);
+    d->h2 = du_fmix(h2);
+}
+
+void* du_hash_thread(void *arg){
+    struct du_hashjob *job = arg;
+    // Hueco extra para completar el último bloque de 16 bytes.
+    char *buf = malloc(DU_HASHBUF + 16);
+    size_t i;
+    if (buf == NULL){
+        perror("malloc");
+        return NULL;
+    }
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->n)
+        du_hash_file(job->items[i], job->limit, buf);
+    free(buf);
+    return NULL;
+}
+
+// Resume los `n` ficheros de `items` con `nthreads` hilos.
+void du_hash_all(struct du_dup **items, size_t n, long long limit, int nthreads){
+    struct du_hashjob job = { items, n, limit };
+    pthread_t th[nthreads];
+    int started = 0;
+    atomic_init(&job.next, 0);
+    for (; started < nthreads && (size_t) started < n; started++)
+        if (pthread_create(&th[started], NULL, du_hash_thread, &job) != 0)
+            break;
+    // El hilo actual también trabaja y termina lo que quede.
+    du_hash_thread(&job);
+    for (int i = 0; i < started; i++)
+        pthread_join(th[i], NULL);
+}
+
+int du_dup_cmp_ino(const void *a, const void *b){
+    const struct du_dup *x = *(struct du_dup * const *) a, *y = *(struct du_dup * const *) b;
+    if (x->dev != y->dev)
+        return x->dev < y->dev ? -1 : 1;
+    if (x->ino != y->ino)
+        return x->ino < y->ino ? -1 : 1;
+    return 0;
+}
+
+int du_dup_cmp(const void *a, const void *b){
+    const struct du_dup *x = *(struct du_dup * const *) a, *y = *(struct du_dup * const *) b;
+    if (x->size != y->size)
+        return x->size < y->size ? -1 : 1;
+    if (x->h1 != y->h1)
+        return x->h1 < y->h1 ? -1 : 1;
+    if (x->h2 != y->h2)
+        return x->h2 < y->h2 ? -1 : 1;
+    return 0;
+}
+
+// Deja en `items` sólo los que tienen otro igual (mismo tamaño y
+// resumen) y se leyeron bien. Retorna cuántos quedan.
+size_t du_dup_filter(struct du_dup **items, size_t n){
+    size_t kept = 0;
+    qsort(items, n, sizeof(*items), du_dup_cmp);
+    for (size_t i = 0; i < n; ){
+        size_t j = i + 1;
+        while (j < n && du_dup_cmp(&items[i], &items[j]) == 0)
+            j++;
+        for (size_t k = i; j - i > 1 && k < j; k++)
+            if (!items[k]->err)
+                items[kept++] = items[k];
+        i = j;
+    }
+    return kept;
+}
+
+// Lee hasta `n` bytes de `fd` en `buf`. Retorna los leídos, menos de `n`
+// sólo al final del fichero, o -1 si hay un error.
+ssize_t du_dup_read(int fd, char *buf, size_t n){
+    size_t got = 0;
+    while (got < n){
+        ssize_t r = read(fd, buf + got, n - got);
+        if (r == 0)
+            break;
+        if (r == -1){
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        got += r;
+    }
+    return got;
+}
+
+// Compara byte a byte el contenido de `a` y `b`, del mismo tamaño, con
+// `buf` de 2 * DU_HASHBUF bytes. Retorna 1 si es igual y 0 si difiere o
+// no se puede leer alguno.
+int du_dup_same(const struct du_dup *a, const struct du_dup *b, char *buf){
+    int same = 0;
+    int fa = open(a->path, O_RDONLY);
+    int fb = fa == -1 ? -1 : open(b->path, O_RDONLY);
+    if (fb != -1){
+        posix_fadvise(fa, 0, 0, POSIX_FADV_SEQUENTIAL);
+        posix_fadvise(fb, 0, 0, POSIX_FADV_SEQUENTIAL);
+        while (1){
+            ssize_t na = du_dup_read(fa, buf, DU_HASHBUF);
+            ssize_t nb = du_dup_read(fb, buf + DU_HASHBUF, DU_HASHBUF);
+            if (na == -1 || na != nb || memcmp(buf, buf + DU_HASHBUF, na) != 0)
+                break;
+            if (na < DU_HASHBUF){
+                same = 1;
+                break;
+            }
+        }
+    }
+    if (fa != -1)
+        close(fa);
+    if (fb != -1)
+        close(fb);
+    return same;
+}
+
+// Busca los duplicados entre los ficheros apuntados e imprime cada grupo
+// y el total recuperable.
+void du_dup_report(int nthreads){
+    struct du_dup **items = malloc((du_ndups + 1) * sizeof(*items));
+    long long reclaim = 0;
+    size_t nfiles = 0;
+    if (items == NULL){
+        perror("malloc");
+        return;
+    }
+    for (size_t i = 0; i < du_ndups; i++)
+        items[i] = &du_dups[i];
+
+    // Un mismo inodo (enlaces duros o argumentos solapados) no es una
+    // copia: se queda sólo su primera aparición.
+    qsort(items, du_ndups, sizeof(*items), du_dup_cmp_ino);
+    size_t n = 0;
+    for (size_t i = 0; i < du_ndups; i++)
+        if (n == 0 || du_dup_cmp_ino(&items[n - 1], &items[i]) != 0)
+            items[n++] = items[i];
+
+    // Sin leer nada, se descartan los de tamaño único (resumen a 0).
+    n = du_dup_filter(items, n);
+    // Primer bloque de cada candidato.
+    du_hash_all(items, n, DU_PREFIX, nthreads);
+    n = du_dup_filter(items, n);
+    // Contenido completo de los que aún coinciden y son más grandes que
+    // el primer bloque; en el resto el resumen ya es completo.
+    size_t nbig = 0;
+    struct du_dup **big = malloc((n + 1) * sizeof(*big));
+    if (big == NULL){
+        perror("malloc");
+        free(items);
+        return;
+    }
+    for (size_t i = 0; i < n; i++)
+        if (items[i]->size > DU_PREFIX)
+            big[nbig++] = items[i];
+    du_hash_all(big, nbig, -1, nthreads);
+    free(big);
+    n = du_dup_filter(items, n);
+
+    char *buf = malloc(2 * DU_HASHBUF);
+    if (buf == NULL){
+        perror("malloc");
+        free(items);
+        return;
+    }
+    for (size_t i = 0; i < n; ){
+        size_t j = i + 1;
+        while (j < n && du_dup_cmp(&items[i], &items[j]) == 0)
+            j++;
+        // Cada fichero del grupo se compara con el primero; los que
+        // difieren (colisiones del resumen) pasan al principio del resto y
+        // se vuelven a agrupar entre ellos.
+        for (size_t first = i, end = j; end - first > 1; first++){
+            size_t rest = first + 1;
+            for (size_t k = first + 1; k < end; k++){
+                if (du_dup_same(items[first], items[k], buf)){
+                    fprintf(stdout, "(R) %s: %lld = %s\n", items[k]->path, items[k]->usage, items[first]->path);
+                    reclaim += items[k]->usage;
+                    nfiles++;
+                }
+                else
+                    items[rest++] = items[k];
+            }
+            end = rest;
+        }
+        i = j;
+    }
+    free(buf);
+    fprintf(stdout, "(R) recuperable: %lld en %zu fichero(s) duplicado(s)\n", reclaim, nfiles);
+
+    free(items);
+    for (size_t i = 0; i < du_ndups; i++)
+        free(du_dups[i].path);
+    free(du_dups);
+    du_dups = NULL;
+    du_ndups = du_capdups = 0;
+}
+
+// Subtotales por directorio de du (-d N)
+// -----
+
+// nftw recorre en preorden: un directorio llega antes que su contenido y
+// `ftwbuf->level` indica la profundidad. Con una pila de directorios
+// abiertos, al llegar una entrada de nivel L se cierran todos los de
+// nivel >= L: se imprime su subtotal y se suma al directorio padre. Así
+// se obtienen todos los subtotales hasta la profundidad N en un solo
+// recorrido. Los directorios más profundos no se apilan y sus ficheros se
+// suman a su antecesor apilado más cercano.
+struct du_level {
+    char *path;
+    int level;
+    long long total;
+};
+
+static int du_dflag = 0;
+static int du_depth = 0;
+static struct du_level *du_stack = NULL;
+static int du_nstack = 0;
+static int du_capstack = 0;
+
+// Cierra los directorios de nivel >= `level`. El directorio raíz (nivel
+// 0) no se imprime: su total lo imprime run_du. Con -n -D, los
+// subtotales son candidatos a la lista de los más grandes.
+void du_unwind(int level){
+    while (du_nstack > 0 && du_stack[du_nstack - 1].level >= level){
+        struct du_level *top = &du_stack[--du_nstack];
+        if (du_dflag && top->level > 0 && top->level <= du_depth)
+            fprintf(stdout, "(D) %s: %lld\n", top->path, top->total);
+        if (du_topdirs && top->level > 0)
+            du_top_offer(top->path, top->total, 'D');
+        if (du_nstack > 0)
+            du_stack[du_nstack - 1].total += top->total;
+        free(top->path);
+    }
+}
+
+void du_enter(const char *fpath, int level){
+    if (du_nstack == du_capstack){
+        du_capstack = du_capstack ? du_capstack * 2 : 16;
+        if ((du_stack = realloc(du_stack, du_capstack * sizeof(*du_stack))) == NULL){
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    du_stack[du_nstack].path = strdup(fpath);
+    du_stack[du_nstack].level = level;
+    du_stack[du_nstack].total = 0;
+    du_nstack++;
+}
+
+// Caché persistente de du (-c FICHERO)
+// -----
+
+// El fichero de caché guarda, para cada directorio recorrido, su (dev,
+// ino), su mtime y la suma del tamaño y de los bloques de los ficheros
+// que contiene directamente. Se proyecta en memoria con mmap y se busca
+// por bisección, porque los registros se guardan ordenados. El mtime de
+// un directorio sólo cambia cuando se crean, borran o renombran entradas
+// suyas, así que los totales que se guardan no son recursivos: en un
+// directorio sin cambios no se hace stat de sus ficheros, pero sí se
+// baja a sus subdirectorios para comprobarlos también. Al guardar se
+// conservan los registros de los directorios que no se han recorrido, de
+// modo que varios árboles pueden compartir un mismo fichero de caché.
+//
+// Para contar una sola vez los enlaces duros hay que ver cada fichero con
+// varios enlaces, y su suma depende además de -l, así que los directorios
+// que los tienen se guardan marcados y se recorren siempre enteros. No se
+// detecta un enlace nuevo a un fichero de un directorio sin cambios: el
+// directorio del enlace sí se vuelve a recorrer, pero el del fichero
+// original no.
+#define DU_CACHE_MAGIC "SSHDUC2"
+
+struct du_cachehdr {
+    char magic[8];
+    uint64_t count;
+};
+
+struct du_cacherec {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t size;   // Suma de st_size de sus ficheros
+    int64_t blocks; // Suma de st_blocks*512 de sus ficheros
+    int64_t links;  // Ficheros con st_nlink > 1
+};
+
+static char *du_cache = NULL;                 // Fichero de caché, si se usa
+static struct du_cacherec *du_cache_old;      // Registros de la última ejecución
+static size_t du_cache_nold;
+static void *du_cache_map = NULL;
+static size_t du_cache_maplen;
+static struct du_cacherec *du_cache_new;      // Registros de esta ejecución
+static size_t du_cache_nnew, du_cache_capnew;
+static pthread_mutex_t du_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_long du_cache_reused;
+static atomic_long du_cache_scanned;
+
+int du_cacherec_cmp(const void *a, const void *b){
+    const struct du_cacherec *x = a, *y = b;
+    if (x->dev != y->dev)
+        return x->dev < y->dev ? -1 : 1;
+    if (x->ino != y->ino)
+        return x->ino < y->ino ? -1 : 1;
+    return 0;
+}
+
+// Proyecta en memoria el fichero de caché. Si no existe o no es válido,
+// se empieza con la caché vacía.
+void du_cache_load(const char *file){
+    struct stat st;
+    int fd = open(file, O_RDONLY);
+    du_cache_old = NULL;
+    du_cache_nold = 0;
+    du_cache_nnew = 0;
+    atomic_store(&du_cache_reused, 0);
+    atomic_store(&du_cache_scanned, 0);
+    if (fd == -1)
+        return;
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(struct du_cachehdr)){
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED){
+            struct du_cachehdr *hdr = map;
+            if (memcmp(hdr->magic, DU_CACHE_MAGIC, sizeof(DU_CACHE_MAGIC)) == 0
+                    && sizeof(*hdr) + hdr->count * sizeof(struct du_cacherec) == (size_t) st.st_size){
+                du_cache_map = map;
+                du_cache_maplen = st.st_size;
+                du_cache_old = (struct du_cacherec*)(hdr + 1);
+                du_cache_nold = hdr->count;
+            }
+            else
+                munmap(map, st.st_size);
+        }
+    }
+    close(fd);
+}
+
+// Retorna el registro del directorio `st` si no ha cambiado desde la
+// última ejecución, o `NULL`.
+struct du_cacherec* du_cache_find(const struct stat *st){
+    struct du_cacherec key = { st->st_dev, st->st_ino };
+    struct du_cacherec *rec;
+    // Sin caché anterior `du_cache_old` es NULL, que bsearch no admite.
+    if (du_cache_nold == 0)
+        return NULL;
+    rec = bsearch(&key, du_cache_old, du_cache_nold, sizeof(key), du_cacherec_cmp);
+    if (rec == NULL || rec->mtime_sec != st->st_mtim.tv_sec || rec->mtime_nsec != st->st_mtim.tv_nsec)
+        return NULL;
+    return rec;
+}
+
+void du_cache_add(const struct stat *st, long long size, long long blocks, long long links){
+    pthread_mutex_lock(&du_cache_lock);
+    if (du_cache_nnew == du_cache_capnew){
+        du_cache_capnew = du_cache_capnew ? du_cache_capnew * 2 : 1024;
+        if ((du_cache_new = realloc(du_cache_new, du_cache_capnew * sizeof(*du_cache_new))) == NULL){
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    struct du_cacherec *rec = &du_cache_new[du_cache_nnew++];
+    rec->dev = st->st_dev;
+    rec->ino = st->st_ino;
+    rec->mtime_sec = st->st_mtim.tv_sec;
+    rec->mtime_nsec = st->st_mtim.tv_nsec;
+    rec->size = size;
+    rec->blocks = blocks;
+    rec->links = links;
+    pthread_mutex_unlock(&du_cache_lock);
+}
+
+// Mezcla los registros de esta ejecución, ordenados, con los de la
+// anterior que no se han vuelto a ver, los escribe en un fichero temporal
+// que sustituye al anterior con `rename()` y libera la caché.
+void du_cache_save(const char *file){
+    char tmp[MAXPATH];
+    struct du_cachehdr hdr;
+    struct du_cacherec *all;
+    size_t n = 0, i = 0, j = 0;
+    snprintf(tmp, MAXPATH, "%s.tmp", file);
+    qsort(du_cache_new, du_cache_nnew, sizeof(*du_cache_new), du_cacherec_cmp);
+    if ((all = malloc((du_cache_nnew + du_cache_nold + 1) * sizeof(*all))) == NULL){
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    // Ambos están ordenados; si un directorio está en los dos, vale el
+    // registro nuevo.
+    while (i < du_cache_nnew || j < du_cache_nold){
+        int c = i == du_cache_nnew ? 1 : j == du_cache_nold ? -1
+                : du_cacherec_cmp(&du_cache_new[i], &du_cache_old[j]);
+        if (c <= 0)
+            all[n++] = du_cache_new[i++];
+        else
+            all[n++] = du_cache_old[j++];
+        if (c == 0)
+            j++;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, DU_CACHE_MAGIC, sizeof(DU_CACHE_MAGIC));
+    hdr.count = n;
+    int fd = open(tmp, OPENFLAGS, S_IRUSR | S_IWUSR);
+    if (fd == -1)
+        perror(tmp);
+    else if (write_all(fd, (char*)&hdr, sizeof(hdr)) == -1
+            || write_all(fd, (char*)all, n * sizeof(*all)) == -1){
+        perror("write");
+        close(fd);
+        unlink(tmp);
+    }
+    else if (close(fd) == -1 || rename(tmp, file) == -1)
+        perror(file);
+
+    if (du_cache_map)
+        munmap(du_cache_map, du_cache_maplen);
+    du_cache_map = NULL;
+    du_cache_old = NULL;
+    du_cache_nold = 0;
+    free(all);
+    free(du_cache_new);
+    du_cache_new = NULL;
+    du_cache_nnew = du_cache_capnew = 0;
+}
+
+// statx por lotes con io_uring (-i)
+// -----
+
+// En vez de un stat bloqueante por entrada, se leen los nombres de cada
+// directorio con getdents64 y se envían todos sus statx de una vez a un
+// anillo io_uring propio de cada hilo. Sólo se piden los campos que usa
+// du (tipo, tamaño, bloques, inodo y enlaces). Se usan las llamadas al
+// sistema directamente para no depender de liburing.
+struct du_ring {
+    int fd;
+    unsigned entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_len, cq_len, sqes_len;
+    struct statx *stx; // Un resultado por entrada del anillo
+};
+
+static int du_iflag = 0; // Usar io_uring para los stat
+
+void du_ring_free(struct du_ring *r){
+    if (r == NULL)
+        return;
+    if (r->sqes)
+        munmap(r->sqes, r->sqes_len);
+    if (r->cq_ptr && r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr, r->cq_len);
+    if (r->sq_ptr)
+        munmap(r->sq_ptr, r->sq_len);
+    if (r->fd != -1)
+        close(r->fd);
+    free(r->stx);
+    free(r);
+}
+
+// Crea un anillo de `entries` entradas. Retorna `NULL` si el núcleo no
+// admite io_uring o está deshabilitado.
+struct du_ring* du_ring_init(unsigned entries){
+    struct io_uring_params p;
+    struct du_ring *r = calloc(1, sizeof(*r));
+    if (r == NULL)
+        return NULL;
+    memset(&p, 0, sizeof(p));
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd == -1){
+        free(r);
+        return NULL;
+    }
+    r->entries = p.sq_entries;
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP){
+        if (r->cq_len > r->sq_len)
+            r->sq_len = r->cq_len;
+        r->cq_len = r->sq_len;
+    }
+    r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED){
+        r->sq_ptr = NULL;
+        du_ring_free(r);
+        return NULL;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->cq_ptr = r->sq_ptr;
+    else{
+        r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED){
+            r->cq_ptr = NULL;
+            du_ring_free(r);
+            return NULL;
+        }
+    }
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED){
+        r->sqes = NULL;
+        du_ring_free(r);
+        return NULL;
+    }
+    r->sq_head = (unsigned*)((char*)r->sq_ptr + p.sq_off.head);
+    r->sq_tail = (unsigned*)((char*)r->sq_ptr + p.sq_off.tail);
+    r->sq_mask = (unsigned*)((char*)r->sq_ptr + p.sq_off.ring_mask);
+    r->sq_array = (unsigned*)((char*)r->sq_ptr + p.sq_off.array);
+    r->cq_head = (unsigned*)((char*)r->cq_ptr + p.cq_off.head);
+    r->cq_tail = (unsigned*)((char*)r->cq_ptr + p.cq_off.tail);
+    r->cq_mask = (unsigned*)((char*)r->cq_ptr + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)((char*)r->cq_ptr + p.cq_off.cqes);
+    if ((r->stx = calloc(r->entries, sizeof(struct statx))) == NULL){
+        du_ring_free(r);
+        return NULL;
+    }
+    return r;
+}
+
+// Lee los resultados que haya en la cola de completados del lote de
+// `names`. Retorna cuántos ha leído.
+int du_ring_reap(struct du_ring *r, int dfd, char **names, struct stat *st, int *ok){
+    unsigned head = *r->cq_head;
+    int done = 0;
+    while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)){
+        struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        int i = cqe->user_data;
+        struct statx *x = &r->stx[i];
+        ok[i] = cqe->res == 0;
+        // Si el núcleo no tiene IORING_OP_STATX se hace el stat aquí.
+        if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP)
+            ok[i] = fstatat(dfd, names[i], &st[i], 0) == 0;
+        else if (ok[i]){
+            memset(&st[i], 0, sizeof(st[i]));
+            st[i].st_mode = x->stx_mode;
+            st[i].st_size = x->stx_size;
+            st[i].st_blocks = x->stx_blocks;
+            st[i].st_ino = x->stx_ino;
+            st[i].st_nlink = x->stx_nlink;
+            st[i].st_dev = makedev(x->stx_dev_major, x->stx_dev_minor);
+        }
+        head++;
+        done++;
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    return done;
+}
+
+// Hace statx de los `n` nombres de `names` (n <= entradas del anillo),
+// relativos a `dfd`, con una sola llamada a io_uring_enter. Deja los
+// resultados en `st` y en `ok` si cada uno tuvo éxito. Retorna -1 si
+// io_uring_enter falla: el anillo ya no se puede usar y el lote hay que
+// hacerlo con fstatat.
+int du_ring_statx(struct du_ring *r, int dfd, char **names, int n,
+                  struct stat *st, int *ok){
+    unsigned tail = *r->sq_tail;
+    for (int i = 0; i < n; i++){
+        unsigned idx = (tail + i) & *r->sq_mask;
+        struct io_uring_sqe *sqe = &r->sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_STATX;
+        sqe->fd = dfd;
+        sqe->addr = (unsigned long) names[i];
+        sqe->len = STATX_TYPE | STATX_SIZE | STATX_BLOCKS | STATX_INO | STATX_NLINK;
+        sqe->off = (unsigned long) &r->stx[i];
+        sqe->statx_flags = AT_STATX_SYNC_AS_STAT;
+        sqe->user_data = i;
+        r->sq_array[idx] = idx;
+    }
+    __atomic_store_n(r->sq_tail, tail + n, __ATOMIC_RELEASE);
+
+    int done = 0;
+    while (done < n){
+        if (syscall(__NR_io_uring_enter, r->fd, done == 0 ? n : 0, n - done,
+                    IORING_ENTER_GETEVENTS, NULL, 0) == -1){
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        done += du_ring_reap(r, dfd, names, st, ok);
+    }
+    if (done == n)
+        return 0;
+
+    // Las peticiones que el núcleo ya ha tomado de la cola pueden seguir en
+    // curso: se espera a que terminen para que sus resultados no se lean
+    // como del lote siguiente ni escriban en `stx` después de liberarlo.
+    // Si no se puede, `stx` no se libera.
+    unsigned taken = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) - tail;
+    while (done < (int) taken){
+        if (syscall(__NR_io_uring_enter, r->fd, 0, taken - done,
+                    IORING_ENTER_GETEVENTS, NULL, 0) == -1 && errno != EINTR)
+            break;
+        done += du_ring_reap(r, dfd, names, st, ok);
+    }
+    if (done < (int) taken)
+        r->stx = NULL;
+    return -1;
+}
+
+// Recorrido paralelo de du (-j N)
+// -----
+
+// Cada hilo tiene una cola doble de directorios pendientes. El propio
+// hilo añade y saca por el final (recorrido en profundidad, la cola se
+// mantiene pequeña) y los hilos sin trabajo roban por el principio, donde
+// están los directorios más altos del árbol y, por tanto, los trabajos
+// más grandes. Las colas guardan rutas y no descriptores abiertos para no
+// agotar los descriptores en árboles muy anchos; cada directorio se
+// procesa con su descriptor y `fstatat()` relativo a él.
+struct du_deque {
+    pthread_mutex_t lock;
+    char **items;
+    size_t head, tail, cap;
+};
+
+struct du_worker {
+    pthread_t th;
+    int id;
+    struct du_deque dq;
+    long long total; // Subtotal del hilo, se suma al final
+    long long links; // Ficheros con varios enlaces vistos por el hilo
+    struct du_ring *ring; // Anillo io_uring del hilo (-i), o NULL
+};
+
+struct du_dirid {
+    dev_t dev;
+    ino_t ino;
+};
+
+static struct du_worker *du_workers;
+static int du_nworkers;
+static atomic_long du_pending;  // Directorios encolados o en proceso
+static atomic_long du_queued;   // Directorios encolados
+static pthread_mutex_t du_idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t du_idle_cond = PTHREAD_COND_INITIALIZER;
+// Directorios ya visitados. Como nftw sin FTW_PHYS, se siguen los enlaces
+// simbólicos y se evita visitar dos veces el mismo directorio.
+static void *du_visited;
+static pthread_mutex_t du_visited_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int du_dirid_cmp(const void *a, const void *b){
+    const struct du_dirid *x = a, *y = b;
+    if (x->dev != y->dev)
+        return x->dev < y->dev ? -1 : 1;
+    if (x->ino != y->ino)
+        return x->ino < y->ino ? -1 : 1;
+    return 0;
+}
+
+// Marca como visitado el directorio `sb`. Retorna 0 si ya lo estaba.
+int du_visit(const struct stat *sb){
+    struct du_dirid *id = malloc(sizeof(*id));
+    if (id == NULL){
+        perror("malloc");
+        return 0;
+    }
+    id->dev = sb->st_dev;
+    id->ino = sb->st_ino;
+    pthread_mutex_lock(&du_visited_lock);
+    struct du_dirid **found = tsearch(id, &du_visited, du_dirid_cmp);
+    pthread_mutex_unlock(&du_visited_lock);
+    if (found == NULL || *found != id){
+        free(id);
+        return 0;
+    }
+    return 1;
+}
+
+void du_push(struct du_worker *w, char *path){
+    struct du_deque *dq = &w->dq;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail == dq->cap){
+        // Se compacta antes de crecer.
+        if (dq->head > 0){
+            memmove(dq->items, dq->items + dq->head, (dq->tail - dq->head) * sizeof(char*));
+            dq->tail -= dq->head;
+            dq->head = 0;
+        }
+        if (dq->tail == dq->cap){
+            dq->cap = dq->cap ? dq->cap * 2 : 64;
+            if ((dq->items = realloc(dq->items, dq->cap * sizeof(char*))) == NULL){
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    dq->items[dq->tail++] = path;
+    pthread_mutex_unlock(&dq->lock);
+
+    atomic_fetch_add(&du_pending, 1);
+    atomic_fetch_add(&du_queued, 1);
+    pthread_mutex_lock(&du_idle_lock);
+    pthread_cond_signal(&du_idle_cond);
+    pthread_mutex_unlock(&du_idle_lock);
+}
+
+// Saca un directorio de la cola de `w`: por el final si `steal` es 0 (el
+// propio hilo) o por el principio si es un robo.
+char* du_pop(struct du_worker *w, int steal){
+    struct du_deque *dq = &w->dq;
+    char *path = NULL;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->head != dq->tail){
+        path = steal ? dq->items[dq->head++] : dq->items[--dq->tail];
+        if (dq->head == dq->tail)
+            dq->head = dq->tail = 0;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    if (path)
+        atomic_fetch_sub(&du_queued, 1);
+    return path;
+}
+
+// Trata una entrada `name` del directorio `path`: si es un directorio se
+// encola y si es un fichero se suma, salvo que el directorio venga de la
+// caché (`cached`). `dsize` y `dblocks` acumulan el total del directorio.
+void du_walk_entry(struct du_worker *w, const char *path, const char *name,
+                   const struct stat *sb, int cached, long long *dsize, long long *dblocks){
+    if (S_ISDIR(sb->st_mode)){
+        if (!du_visit(sb))
+            return;
+        char *child = malloc(strlen(path) + strlen(name) + 2);
+        if (child == NULL){
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        sprintf(child, "%s/%s", path, name);
+        du_push(w, child);
+        return;
+    }
+    if (cached || !S_ISREG(sb->st_mode))
+        return;
+    if (sb->st_nlink > 1)
+        w->links++;
+    if (du_keep(sb) && du_first_link(sb)){
+        w->total += du_size(sb);
+        *dsize += sb->st_size;
+        *dblocks += (long long) sb->st_blocks*512;
+    }
+}
+
+// Indica si hace falta el stat de una entrada de tipo `type`: sólo
+// cuentan los ficheros regulares y los directorios, y en un directorio
+// de la caché sólo los posibles directorios.
+int du_need_stat(const char *name, unsigned char type, int cached){
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+        return 0;
+    if (type == DT_DIR || type == DT_LNK || type == DT_UNKNOWN)
+        return 1;
+    return type == DT_REG && !cached;
+}
+
+// Hace los stat del lote `names` con el anillo del hilo o, si no tiene o
+// deja de funcionar, con fstatat. Un anillo que falla se descarta.
+void du_stat_batch(struct du_worker *w, int dfd, char **names, int n,
+                   struct stat *st, int *ok){
+    if (w->ring != NULL && du_ring_statx(w->ring, dfd, names, n, st, ok) == 0)
+        return;
+    du_ring_free(w->ring);
+    w->ring = NULL;
+    for (int i = 0; i < n; i++)
+        ok[i] = fstatat(dfd, names[i], &st[i], 0) == 0;
+}
+
+// Lee las entradas de `dfd` con getdents64 y hace sus stat por lotes en
+// el anillo del hilo.
+void du_walk_dir_ring(struct du_worker *w, int dfd, const char *path, int cached,
+                      long long *dsize, long long *dblocks){
+    char buf[DU_DENTSIZE];
+    int n = w->ring->entries;
+    char *names[n];
+    struct stat st[n];
+    int ok[n];
+    long nread;
+    while ((nread = syscall(SYS_getdents64, dfd, buf, sizeof(buf))) > 0){
+        int count = 0;
+        for (long off = 0; off < nread; ){
+            struct linux_dirent64 {
+                uint64_t d_ino;
+                int64_t d_off;
+                unsigned short d_reclen;
+                unsigned char d_type;
+                char d_name[];
+            } *de = (struct linux_dirent64*)(buf + off);
+            off += de->d_reclen;
+            if (!du_need_stat(de->d_name, de->d_type, cached))
+                continue;
+            names[count++] = de->d_name;
+            if (count == n){
+                du_stat_batch(w, dfd, names, count, st, ok);
+                for (int i = 0; i < count; i++)
+                    if (ok[i])
+                        du_walk_entry(w, path, names[i], &st[i], cached, dsize, dblocks);
+                count = 0;
+            }
+        }
+        if (count > 0){
+            du_stat_batch(w, dfd, names, count, st, ok);
+            for (int i = 0; i < count; i++)
+                if (ok[i])
+                    du_walk_entry(w, path, names[i], &st[i], cached, dsize, dblocks);
+        }
+    }
+    if (nread == -1)
+        perror(path);
+}
+
+// Suma los ficheros de un directorio y encola sus subdirectorios. Con la
+// caché, si el directorio no ha cambiado se toma la suma guardada y sólo
+// se hace stat de las entradas que pueden ser directorios.
+void du_walk_dir(struct du_worker *w, char *path){
+    int dfd = open(path, O_RDONLY | O_DIRECTORY);
+    DIR *dir = NULL;
+    struct dirent *de;
+    struct stat dst;
+    struct du_cacherec *rec = NULL;
+    long long dsize = 0, dblocks = 0, links = w->links;
+    if (dfd == -1 || (w->ring == NULL && (dir = fdopendir(dfd)) == NULL)){
+        perror(path);
+        if (dfd != -1)
+            close(dfd);
+        return;
+    }
+    // Un directorio con enlaces duros se recorre siempre.
+    if (du_cache && fstat(dfd, &dst) == 0 && (rec = du_cache_find(&dst)) != NULL
+            && rec->links)
+        rec = NULL;
+    if (rec != NULL){
+        dsize = rec->size;
+        dblocks = rec->blocks;
+        w->total += du_bflag ? dblocks : dsize;
+    }
+    if (w->ring)
+        du_walk_dir_ring(w, dfd, path, rec != NULL, &dsize, &dblocks);
+    else{
+        while ((de = readdir(dir)) != NULL){
+            struct stat sb;
+            if (!du_need_stat(de->d_name, de->d_type, rec != NULL))
+                continue;
+            if (fstatat(dfd, de->d_name, &sb, 0) == -1)
+                continue;
+            du_walk_entry(w, path, de->d_name, &sb, rec != NULL, &dsize, &dblocks);
+        }
+    }
+    if (du_cache){
+        du_cache_add(&dst, dsize, dblocks, rec ? 0 : w->links - links);
+        atomic_fetch_add(rec ? &du_cache_reused : &du_cache_scanned, 1);
+    }
+    if (dir)
+        closedir(dir);
+    else
+        close(dfd);
+}
+
+void* du_worker_main(void *arg){
+    struct du_worker *w = arg;
+    // Si el anillo no se puede crear, este hilo usa fstatat.
+    if (du_iflag)
+        w->ring = du_ring_init(DU_RINGSIZE);
+    while (1){
+        char *path = du_pop(w, 0);
+        // Sin trabajo propio: se intenta robar al resto de hilos.
+        for (int i = 1; path == NULL && i < du_nworkers; i++)
+            path = du_pop(&du_workers[(w->id + i) % du_nworkers], 1);
+        if (path){
+            du_walk_dir(w, path);
+            free(path);
+            if (atomic_fetch_sub(&du_pending, 1) == 1){
+                pthread_mutex_lock(&du_idle_lock);
+                pthread_cond_broadcast(&du_idle_cond);
+                pthread_mutex_unlock(&du_idle_lock);
+            }
+            continue;
+        }
+        // Se espera a que alguien encole trabajo o a que termine todo.
+        pthread_mutex_lock(&du_idle_lock);
+        while (atomic_load(&du_queued) == 0 && atomic_load(&du_pending) > 0)
+            pthread_cond_wait(&du_idle_cond, &du_idle_lock);
+        pthread_mutex_unlock(&du_idle_lock);
+        if (atomic_load(&du_pending) == 0){
+            du_ring_free(w->ring);
+            w->ring = NULL;
+            return NULL;
+        }
+    }
+}
+
+// Recorre el directorio `path` con `nthreads` hilos y retorna la suma de
+// los subtotales de todos ellos.
+long long du_walk(const char *path, int nthreads){
+    struct stat st;
+    long long total = 0;
+
+    du_nworkers = nthreads;
+    du_workers = calloc(nthreads, sizeof(*du_workers));
+    if (du_workers == NULL){
+        perror("calloc");
+        return -1;
+    }
+    atomic_store(&du_pending, 0);
+    atomic_store(&du_queued, 0);
+    du_visited = NULL;
+    for (int i = 0; i < nthreads; i++){
+        du_workers[i].id = i;
+        pthread_mutex_init(&du_workers[i].dq.lock, NULL);
+    }
+    if (stat(path, &st) == 0)
+        du_visit(&st);
+    du_push(&du_workers[0], strdup(path));
+
+    int started = 0;
+    for (; started < nthreads; started++)
+        if (pthread_create(&du_workers[started].th, NULL, du_worker_main, &du_workers[started]) != 0)
+            break;
+    // Si no se pudo crear ningún hilo, se recorre en este.
+    if (started == 0){
+        du_nworkers = 1;
+        du_worker_main(&du_workers[0]);
+    }
+    for (int i = 0; i < started; i++)
+        pthread_join(du_workers[i].th, NULL);
+
+    for (int i = 0; i < nthreads; i++){
+        total += du_workers[i].total;
+        free(du_workers[i].dq.items);
+        pthread_mutex_destroy(&du_workers[i].dq.lock);
+    }
+    free(du_workers);
+    tdestroy(du_visited, free);
+    return total;
+}
+
+// Vigilancia de du (-w SECS)
+// -----
+
+// Tras un primer recorrido se guarda en memoria el árbol de directorios,
+// con el tamaño de cada fichero y el total de cada subárbol, y se vigila
+// cada directorio con inotify. Cada evento (creación, borrado,
+// modificación o movimiento) sólo vuelve a hacer stat de la entrada
+// afectada y suma la diferencia a sus directorios antecesores, así que
+// nunca se recorre de nuevo el árbol salvo si se desborda la cola de
+// eventos. Cada SECS segundos (o tras cada lote de eventos si SECS es 0)
+// se imprimen los totales que han cambiado. SIGINT, que está bloqueada
+// en la shell, se lee con signalfd para terminar.
+#define DU_WMASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+
+struct du_wdir;
+
+struct du_wentry {
+    char *name;
+    long long size;       // Lo que aporta el fichero al total
+    struct du_wdir *sub;  // Subdirectorio, o NULL si es un fichero
+};
+
+struct du_wdir {
+    int wd;                   // Descriptor de inotify, -1 si no se vigila
+    int depth;
+    char *path;
+    struct du_wdir *parent;
+    void *entries;            // Árbol de tsearch de du_wentry por nombre
+    long long total;          // Suma del subárbol
+    long long printed;        // Último total impreso
+};
+
+static int du_wsecs = -1;           // SECS de -w, -1 si no se usa
+static int du_wfd = -1;             // Descriptor de inotify
+static struct du_wdir **du_wds;     // Directorios por descriptor de inotify
+static int du_capwds;
+
+int du_wentry_cmp(const void *a, const void *b){
+    return strcmp(((const struct du_wentry *) a)->name, ((const struct du_wentry *) b)->name);
+}
+
+// Suma `delta` al total de `d` y de todos sus antecesores.
+void du_wgrow(struct du_wdir *d, long long delta){
+    for (; d; d = d->parent)
+        d->total += delta;
+}
+
+void du_wfree_dir(struct du_wdir *d);
+
+void du_wfree_entry(void *p){
+    struct du_wentry *e = p;
+    if (e->sub)
+        du_wfree_dir(e->sub);
+    free(e->name);
+    free(e);
+}
+
+// Libera `d` y su subárbol y deja de vigilarlos. Si el directorio ya no
+// existe, inotify_rm_watch falla sin más.
+void du_wfree_dir(struct du_wdir *d){
+    if (d->wd >= 0){
+        inotify_rm_watch(du_wfd, d->wd);
+        du_wds[d->wd] = NULL;
+    }
+    tdestroy(d->entries, du_wfree_entry);
+    free(d->path);
+    free(d);
+}
+
+void du_wadd(struct du_wdir *d, const char *name, const struct stat *sb);
+
+// Crea el nodo del directorio `path`, empieza a vigilarlo y añade sus
+// entradas. Retorna NULL si el directorio ya se vigila, como ocurre con
+// los bucles de enlaces simbólicos, que nftw tampoco recorre dos veces.
+struct du_wdir* du_wopen(struct du_wdir *parent, const char *path){
+    struct du_wdir *d;
+    struct dirent *de;
+    DIR *dir;
+    int wd = inotify_add_watch(du_wfd, path, DU_WMASK);
+    if (wd >= 0 && wd < du_capwds && du_wds[wd] != NULL)
+        return NULL;
+    if (wd == -1)
+        perror(path);
+    if (wd >= du_capwds){
+        int cap = du_capwds ? du_capwds : 64;
+        while (cap <= wd)
+            cap *= 2;
+        if ((du_wds = realloc(du_wds, cap * sizeof(*du_wds))) == NULL){
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+        memset(du_wds + du_capwds, 0, (cap - du_capwds) * sizeof(*du_wds));
+        du_capwds = cap;
+    }
+    if ((d = calloc(1, sizeof(*d))) == NULL){
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    d->wd = wd;
+    d->depth = parent ? parent->depth + 1 : 0;
+    d->path = strdup(path);
+    d->parent = parent;
+    if (wd >= 0)
+        du_wds[wd] = d;
+    // Se vigila antes de leer el directorio para no perder las entradas
+    // que se creen mientras tanto; si llegan también como eventos, se
+    // encuentran ya añadidas.
+    if ((dir = opendir(path)) == NULL){
+        perror(path);
+        return d;
+    }
+    while ((de = readdir(dir)) != NULL){
+        struct stat sb;
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+        if (fstatat(dirfd(dir), de->d_name, &sb, 0) == 0)
+            du_wadd(d, de->d_name, &sb);
+    }
+    closedir(dir);
+    return d;
+}
+
+// Añade la entrada `name` de `d`, descrita por `sb`.
+void du_wadd(struct du_wdir *d, const char *name, const struct stat *sb){
+    struct du_wentry *e;
+    if (!S_ISREG(sb->st_mode) && !S_ISDIR(sb->st_mode))
+        return;
+    if ((e = calloc(1, sizeof(*e))) == NULL){
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    e->name = strdup(name);
+    tsearch(e, &d->entries, du_wentry_cmp);
+    if (S_ISDIR(sb->st_mode)){
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", d->path, name);
+        // Los ficheros del subárbol ya suman en `d` al añadirse.
+        e->sub = du_wopen(d, path);
+    }
+    else{
+        e->size = du_keep(sb) ? du_size(sb) : 0;
+        du_wgrow(d, e->size);
+    }
+}
+
+// Quita la entrada `name` de `d` y resta lo que aportaba.
+void du_wremove(struct du_wdir *d, const char *name){
+    struct du_wentry key = { (char *) name }, **found, *e;
+    if ((found = tfind(&key, &d->entries, du_wentry_cmp)) == NULL)
+        return;
+    e = *found;
+    tdelete(&key, &d->entries, du_wentry_cmp);
+    du_wgrow(d, -(e->sub ? e->sub->total : e->size));
+    du_wfree_entry(e);
+}
+
+// Vuelve a mirar la entrada `name` de `d` tras un evento.
+void du_wupdate(struct du_wdir *d, const char *name){
+    struct du_wentry key = { (char *) name }, **found;
+    struct stat sb;
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", d->path, name);
+    if (stat(path, &sb) == -1){
+        du_wremove(d, name);
+        return;
+    }
+    found = tfind(&key, &d->entries, du_wentry_cmp);
+    // Un fichero que sigue siendo un fichero sólo cambia de tamaño.
+    if (found && (*found)->sub == NULL && S_ISREG(sb.st_mode)){
+        long long now = du_keep(&sb) ? du_size(&sb) : 0;
+        du_wgrow(d, now - (*found)->size);
+        (*found)->size = now;
+        return;
+    }
+    // Un directorio ya vigilado se actualiza con sus propios eventos.
+    if (found && (*found)->sub != NULL && S_ISDIR(sb.st_mode))
+        return;
+    if (found)
+        du_wremove(d, name);
+    du_wadd(d, name, &sb);
+}
+
+// Imprime los directorios cuyo total ha cambiado: las raíces y, con
+// -d N, los subdirectorios hasta la profundidad N.
+void du_wprint(struct du_wdir **roots, int nroots){
+    // Las raíces que no se han podido vigilar no están en du_wds.
+    for (int i = 0; i < nroots; i++){
+        struct du_wdir *d = roots[i];
+        if (d->wd < 0 && d->total != d->printed){
+            fprintf(stdout, "(W) %s: %lld (%+lld)\n", d->path, d->total, d->total - d->printed);
+            d->printed = d->total;
+        }
+    }
+    for (int wd = 0; wd < du_capwds; wd++){
+        struct du_wdir *d = du_wds[wd];
+        if (d == NULL || d->total == d->printed)
+            continue;
+        if (d->depth > 0 && (!du_dflag || d->depth > du_depth))
+            continue;
+        fprintf(stdout, "(W) %s: %lld (%+lld)\n", d->path, d->total, d->total - d->printed);
+        d->printed = d->total;
+    }
+    fflush(stdout);
+}
+
+// Recorre las raíces e imprime su total inicial.
+int du_wbuild(char **paths, int npaths, struct du_wdir **roots){
+    for (int i = 0; i < npaths; i++){
+        // Puede fallar si entre tanto se ha movido otra raíz dentro.
+        if ((roots[i] = du_wopen(NULL, paths[i])) == NULL){
+            fprintf(stderr, "simplesh: du: %s: ya se vigila\n", paths[i]);
+            for (int j = 0; j < i; j++)
+                du_wfree_dir(roots[j]);
+            return -1;
+        }
+        fprintf(stdout, "(D) %s: %lld\n", paths[i], roots[i]->total);
+    }
+    // Lo que se imprima después es lo que cambie a partir de aquí.
+    for (int wd = 0; wd < du_capwds; wd++)
+        if (du_wds[wd])
+            du_wds[wd]->printed = du_wds[wd]->total;
+    for (int i = 0; i < npaths; i++)
+        roots[i]->printed = roots[i]->total;
+    fflush(stdout);
+    return 0;
+}
+
+// Vigila los directorios `paths` hasta recibir SIGINT.
+int du_watch(char **paths, int npaths, int secs){
+    struct du_wdir *roots[npaths];
+    struct pollfd fds[2];
+    struct timespec now, next;
+    sigset_t sigint, old;
+    int status = 0;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    // Un directorio sólo puede tener un nodo, así que las raíces no
+    // pueden estar unas dentro de otras.
+    char real[npaths][PATH_MAX];
+    for (int i = 0; i < npaths; i++){
+        struct stat st;
+        if (stat(paths[i], &st) == -1 || !S_ISDIR(st.st_mode) || realpath(paths[i], real[i]) == NULL){
+            fprintf(stderr, "simplesh: du: %s: no es un directorio\n", paths[i]);
+            return EXIT_FAILURE;
+        }
+        for (int j = 0; j < i; j++){
+            size_t li = strlen(real[i]), lj = strlen(real[j]), l = li < lj ? li : lj;
+            if (strncmp(real[i], real[j], l) == 0 && (li == lj || real[li < lj ? j : i][l] == '/'
+                    || strcmp(real[li < lj ? i : j], "/") == 0)){
+                fprintf(stderr, "simplesh: du: %s y %s se solapan\n", paths[j], paths[i]);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    sigemptyset(&sigint);
+    sigaddset(&sigint, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &sigint, &old);
+    if ((du_wfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1
+            || (fds[1].fd = signalfd(-1, &sigint, SFD_NONBLOCK | SFD_CLOEXEC)) == -1){
+        perror("du");
+        if (du_wfd != -1)
+            close(du_wfd);
+        du_wfd = -1;
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        return EXIT_FAILURE;
+    }
+    fds[0].fd = du_wfd;
+    fds[0].events = fds[1].events = POLLIN;
+
+    if (du_wbuild(paths, npaths, roots) == -1){
+        status = EXIT_FAILURE;
+        npaths = 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    next.tv_sec += secs;
+    while (npaths > 0){
+        int timeout = -1;
+        if (secs > 0){
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long long ms = (next.tv_sec - now.tv_sec) * 1000LL + (next.tv_nsec - now.tv_nsec) / 1000000;
+            timeout = ms > 0 ? (int) ms : 0;
+        }
+        if (poll(fds, 2, timeout) == -1){
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            status = EXIT_FAILURE;
+            break;
+        }
+        if (fds[1].revents & POLLIN){
+            struct signalfd_siginfo si;
+            if (read(fds[1].fd, &si, sizeof(si)) == sizeof(si))
+                break;
+        }
+        if (fds[0].revents & POLLIN){
+            ssize_t n;
+            int overflow = 0;
+            while ((n = read(du_wfd, buf, sizeof(buf))) > 0){
+                for (char *p = buf; p < buf + n; ){
+                    struct inotify_event *ev = (struct inotify_event *) p;
+                    struct du_wdir *d = ev->wd >= 0 && ev->wd < du_capwds ? du_wds[ev->wd] : NULL;
+                    p += sizeof(*ev) + ev->len;
+                    if (ev->mask & IN_Q_OVERFLOW)
+                        overflow = 1;
+                    if (d == NULL || ev->len == 0)
+                        continue;
+                    if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+                        du_wremove(d, ev->name);
+                    else if (ev->mask & (IN_CREATE | IN_MOVED_TO | IN_MODIFY))
+                        du_wupdate(d, ev->name);
+                }
+            }
+            // Se han perdido eventos: no queda más remedio que recorrer
+            // todo otra vez.
+            if (overflow){
+                fprintf(stderr, "simplesh: du: se han perdido eventos, se recorre de nuevo\n");
+                for (int i = 0; i < npaths; i++)
+                    du_wfree_dir(roots[i]);
+                if (du_wbuild(paths, npaths, roots) == -1){
+                    status = EXIT_FAILURE;
+                    npaths = 0;
+                    break;
+                }
+            }
+            if (secs == 0)
+                du_wprint(roots, npaths);
+        }
+        if (secs > 0){
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if (now.tv_sec > next.tv_sec || (now.tv_sec == next.tv_sec && now.tv_nsec >= next.tv_nsec)){
+                du_wprint(roots, npaths);
+                // Si se ha perdido algún intervalo no se imprime varias veces.
+                while (now.tv_sec > next.tv_sec || (now.tv_sec == next.tv_sec && now.tv_nsec >= next.tv_nsec))
+                    next.tv_sec += secs;
+            }
+        }
+    }
+    for (int i = 0; i < npaths; i++)
+        du_wfree_dir(roots[i]);
+    free(du_wds);
+    du_wds = NULL;
+    du_capwds = 0;
+    close(du_wfd);
+    du_wfd = -1;
+    close(fds[1].fd);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return status;
+}
+
+// Indica si el recorrido ha de ser el de nftw porque la salida depende
+// de su orden (-v, -d) o se calcula en du_aux (-n, -R).
+int du_ordered(void){
+    return du_vflag || du_dflag || du_ntop > 0 || du_rflag;
+}
+
+int du_aux(const char *fpath, const struct stat *sb,
+            int tflag, struct FTW *ftwbuf){
+    // Comprobamos las restricciones del comando -t y si es un enlace duro
+    // de un fichero ya contado.
+    int discarded = !du_keep(sb) || (S_ISREG(sb->st_mode) && !du_first_link(sb));
+
+    // Subtotales por directorio: se cierran los directorios que ya no
+    // contienen a esta entrada y se abre esta si es un directorio. Para
+    // -n -D hacen falta los subtotales de todos los directorios.
+    if (du_dflag || du_topdirs){
+        du_unwind(ftwbuf->level);
+        if (tflag == FTW_D && (du_topdirs || ftwbuf->level <= du_depth))
+            du_enter(fpath, ftwbuf->level);
+        else if (!discarded && S_ISREG(sb->st_mode) && du_nstack > 0)
+            du_stack[du_nstack - 1].total += du_size(sb);
+    }
+    
+    // Con -R se apuntan los ficheros para buscar duplicados al final.
+    if (!discarded && du_rflag && S_ISREG(sb->st_mode))
+        du_dup_add(fpath, sb);
+
+    // Con -n no se imprime cada fichero, sólo se guardan los mayores.
+    if (!discarded && du_ntop > 0){
+        if (S_ISREG(sb->st_mode)){
+            totalSize += du_size(sb);
+            du_top_offer(fpath, du_size(sb), 'F');
+        }
+    }
+    // Si no se ha descartado el fichero se imprime la información
+    // dependiendo de las opciones.
+    else if (!discarded){
+        if (du_vflag){
+            for (int i = 0; i < ftwbuf->level; i++) {
+                fprintf(stdout, "\t");
+            }
+            fprintf(stdout, "%s", fpath);
+        }
+        
+        if (S_ISREG(sb->st_mode)){
+            totalSize += du_size(sb);
+            if (du_vflag)
+                fprintf(stdout, ": %lld\n", du_size(sb));
+        }
+        else if(du_vflag)
+            fprintf(stdout, "\n");
+    }
+    return 0; /* To tell nftw() to continue */
+}
+
+// Boletin 4, ejercicio 1 y opcional.
+int run_du(struct execcmd *ecmd){
+    int opt;
+    int cont = ecmd->argc;
+    int du_hflag = 0;
+    int nthreads = 1;
+    int status = 0;
+    // Las opciones son globales para du_aux, así que se reinician en cada
+    // ejecución igual que getopt.
+    du_bflag = du_vflag = du_tflag = du_dflag = du_lflag = du_iflag = 0;
+    du_ntop = du_topdirs = du_rflag = 0;
+    du_wsecs = -1;
+    size = 0;
+    du_cache = NULL;
+    optind = 0;
+    // Procesamos los parámetros
+    while ((opt = getopt(cont, ecmd->argv, "hbvt:j:d:c:lin:DRw:")) != -1){
+        switch (opt){
+            case 'h':
+                du_hflag = 1;
+                break;
+            case 'b':
+                du_bflag = 1;
+                break;
+            case 'v':
+                du_vflag = 1;
+                break;
+            case 't':
+                du_tflag = 1;
+                // Almacenamos el argumento de la opcion t
+                if (parse_size(optarg, &size) == -1)
+                    du_hflag = 1;
+                break;
+            case 'j':
+                if (sscanf(optarg, "%d", &nthreads) != 1 || nthreads < 1)
+                    du_hflag = 1;
+                break;
+            case 'd':
+                du_dflag = 1;
+                if (sscanf(optarg, "%d", &du_depth) != 1 || du_depth < 0)
+                    du_hflag = 1;
+                break;
+            case 'c':
+                du_cache = optarg;
+                break;
+            case 'l':
+                du_lflag = 1;
+                break;
+            case 'i':
+                du_iflag = 1;
+                break;
+            case 'n':
+                if (sscanf(optarg, "%d", &du_ntop) != 1 || du_ntop < 1)
+                    du_hflag = 1;
+                break;
+            case 'D':
+                du_topdirs = 1;
+                break;
+            case 'R':
+                du_rflag = 1;
+                break;
+            case 'w':
+                if (sscanf(optarg, "%d", &du_wsecs) != 1 || du_wsecs < 0)
+                    du_hflag = 1;
+                break;
+            case '?':
+                du_hflag = 1;
+                break;
+        }
+    }
+    // -D sólo tiene sentido con -n.
+    if (du_topdirs && du_ntop == 0)
+        du_hflag = 1;
+    // Si se encuentra la opción h o no se reconoce alguna de las que se introducen,
+    // se muestra la ayuda y se ignoran el resto de opciones.
+    if (du_hflag){
+        fprintf(stdout, "Uso : du [-h] [- b] [ -t SIZE ] [-v ] [-j N] [-d N] [-c CACHE] [-l] [-i] [-n N [-D]] [-R] [-w SECS] [ FICHERO | DIRECTORIO ]\n"\
+        "Para cada fichero, imprime su tamaño.\n"\
+        "Para cada directorio, imprime la suma de los tamaños de todos los ficheros de\n"\
+            "\ttodos sus subdirectorios.\n"\
+            "\tOpciones :\n"\
+            "\t-b Imprime el tamaño ocupado en disco por todos los bloques del fichero.\n"\
+            "\t-t SIZE Excluye todos los ficheros más pequeños que SIZE bytes, si es\n"\
+            "\tnegativo, o más pequeños que SIZE bytes, si es negativo, cuando se\n"\
+                "\t\tprocesa un directorio. Admite los sufijos K, M, G, T, P y E\n"\
+                "\t\t(potencias de 1024), como en -t 10G.\n"\
+            "\t-v Imprime el tamaño de todos y cada uno de los ficheros cuando se procesa un\n"\
+                "\t\tdirectorio.\n" \
+            "\t-j N Recorre cada directorio con N hilos. Se ignora con -v, -d, -n y\n"\
+                "\t\t-R, que necesitan el orden del recorrido.\n" \
+            "\t-d N Imprime también el total de cada subdirectorio hasta la\n"\
+                "\t\tprofundidad N, en un solo recorrido.\n" \
+            "\t-c CACHE Guarda en CACHE el total de cada directorio por su mtime y\n"\
+                "\t\treutiliza los de los directorios que no han cambiado. No detecta\n"\
+                "\t\tficheros modificados sin cambiar su directorio. Se ignora con\n"\
+                "\t\t-t, -v, -d, -n y -R.\n" \
+            "\t-l Cuenta todos los enlaces duros de un fichero, no sólo el primero.\n" \
+            "\t-i Hace los stat por lotes con io_uring, si el sistema lo permite. Se\n"\
+                "\t\tignora con -v, -d, -n y -R.\n" \
+            "\t-n N Imprime sólo los N ficheros más grandes de cada argumento,\n"\
+                "\t\tbuscados en todo su árbol, de mayor a menor, en lugar de cada\n"\
+                "\t\tfichero.\n" \
+            "\t-D Con -n, incluye también los subdirectorios en la lista.\n" \
+            "\t-R Busca ficheros con el mismo contenido e imprime, para cada uno,\n"\
+                "\t\tel fichero del que es copia y el total recuperable. Los\n"\
+                "\t\tficheros se leen con los hilos de -j (por defecto, uno por CPU).\n" \
+            "\t-w SECS Tras el primer recorrido, vigila los directorios con inotify\n"\
+                "\t\te imprime cada SECS segundos (0: en cuanto cambian) los totales\n"\
+                "\t\tque han cambiado, con -d N también los de los subdirectorios,\n"\
+                "\t\thasta recibir SIGINT. Admite -b y -t y cuenta todos los enlaces\n"\
+                "\t\tduros.\n" \
+            "\t-h help\n"\
+        "Nota: todos los tamaños están expresados en bytes\n");
+    }
+    else {
+        struct stat st;
+        int i = optind;
+        if (du_wsecs >= 0){
+            char *cwd[] = { "." };
+            return i < cont ? du_watch(ecmd->argv + i, cont - i, du_wsecs) : du_watch(cwd, 1, du_wsecs);
+        }
+        // La caché sólo guarda totales sin filtrar y recorridos con du_walk.
+        if (du_cache && (du_tflag || du_ordered()))
+            du_cache = NULL;
+        if (du_cache)
+            du_cache_load(du_cache);
+        // Sin io_uring se usa el recorrido de siempre.
+        if (du_iflag){
+            struct du_ring *probe = du_ring_init(1);
+            if (probe == NULL)
+                du_iflag = 0;
+            du_ring_free(probe);
+        }
+        if (du_ntop > 0 && (du_heap = calloc(du_ntop, sizeof(*du_heap))) == NULL){
+            perror("calloc");
+            return EXIT_FAILURE;
+        }
+        do{
+            char * path;
+            // Si no se pasan argumentos, la orden se aplica sobre
+            // el directorio actual.
+            path = i < cont ? ecmd->argv[i] : ".";
+            if (stat(path, &st) == -1) {
+                perror("stat");
+                status = EXIT_FAILURE;
+                break;
+            }
+            // Si es un directorio, usamos nftw para recorrerlo recursivamente,
+            // nos ayudamos de la funcion auxiliar du_aux.
+            if(S_ISDIR(st.st_mode)){
+                int flags = 0;
+                int nopenfd = 20;
+                totalSize = 0;
+                if ((nthreads > 1 || du_cache || du_iflag) && !du_ordered())
+                    totalSize = du_walk(path, nthreads);
+                else if (nftw(path, du_aux, 20, flags) == -1){
+                    perror("nftw");
+                    du_unwind(0);
+                    status = EXIT_FAILURE;
+                    break;
+                }
+                // Se cierran los subdirectorios que quedan abiertos.
+                du_unwind(0);
+                du_top_print();
+                fprintf(stdout,"(D) %s: %lld\n", path, totalSize);
+            }
+            // Si es un fichero, se calcula la información a mostrar en función
+            // de las opciones seleccionadas.
+            else if (S_ISREG(st.st_mode)) {
+                // Restricciones de tamaño con la opcion -t
+                if (du_keep(&st)){
+                    fprintf(stdout,"(F) ");
+                    // En función de la opción -b, imprimimos el tamaño ocupado 
+                    // en disco por todos los bloques, o su tamaño.
+                    fprintf(stdout, "%s: %lld\n", path, du_size(&st));
+                }
+            }
+            i++;
+        } while (i < cont);
+        if (du_rflag)
+            du_dup_report(nthreads > 1 ? nthreads : (int) sysconf(_SC_NPROCESSORS_ONLN));
+        du_links_free();
+        free(du_heap);
+        du_heap = NULL;
+        if (du_cache){
+            fprintf(stderr, "simplesh: du: caché: %ld directorio(s) reutilizado(s), %ld recorrido(s)\n",
+                    atomic_load(&du_cache_reused), atomic_load(&du_cache_scanned));
+            du_cache_save(du_cache);
+        }
+    }
+    return status;
+}
+
+// Tabla de rutas de órdenes
+// -----
+
+// Caché de rutas ya resueltas en `$PATH`, indexada por nombre de orden,
+// para no recorrer todos los directorios de `$PATH` en cada ejecución.
+// Se vacía cuando cambia `$PATH` y se descarta una entrada cuando su
+// ruta deja de existir (`ENOENT`).
+struct hashentry {
+    char *name;
+    char *path;
+    int hits;
+    struct hashentry *next;
+};
+
+static struct hashentry *hashtable[HASHSIZE];
+static char *hash_pathvar = NULL; // Valor de PATH con el que se llenó
+static unsigned long hash_hits = 0;
+static unsigned long hash_misses = 0;
+
+unsigned hash_str(const char *str){
+    unsigned h = 5381;
+    while (*str)
+        h = h * 33 + (unsigned char)*str++;
+    return h % HASHSIZE;
+}
+
+// Vacía la tabla de rutas.
+void hash_clear(void){
+    for (int i = 0; i < HASHSIZE; i++){
+        struct hashentry *e = hashtable[i];
+        while (e){
+            struct hashentry *next = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+            e = next;
+        }
+        hashtable[i] = NULL;
+    }
+}
+
+// Elimina la entrada de `name`, si existe.
+void hash_remove(const char *name){
+    struct hashentry **pe = &hashtable[hash_str(name)];
+    for (; *pe; pe = &(*pe)->next){
+        if (strcmp((*pe)->name, name) == 0){
+            struct hashentry *e = *pe;
+            *pe = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+            return;
+        }
+    }
+}
+
+// Busca `name` en los directorios de `$PATH` como lo haría `execvp()`.
+// Retorna la ruta en memoria dinámica o `NULL` si no se encuentra.
+char* path_search(const char *name){
+    const char *pathvar = getenv("PATH");
+    char candidate[MAXPATH];
+    struct stat st;
+    if (pathvar == NULL)
+        pathvar = "/bin:/usr/bin";
+    while (1){
+        const char *end = strchr(pathvar, ':');
+        int len = end ? end - pathvar : (int) strlen(pathvar);
+        // Un elemento vacío de PATH es el directorio actual.
+        if (len == 0)
+            snprintf(candidate, MAXPATH, "%s", name);
+        else
+            snprintf(candidate, MAXPATH, "%.*s/%s", len, pathvar, name);
+        if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode)
+                && access(candidate, X_OK) == 0)
+            return strdup(candidate);
+        if (end == NULL)
+            return NULL;
+        pathvar = end + 1;
+    }
+}
+
+// Retorna la ruta de la orden `name`, usando la tabla si es posible. Las
+// órdenes con '/' no se buscan en `$PATH` y se retornan tal cual.
+char* hash_lookup(char *name){
+    if (strchr(name, '/'))
+        return name;
+
+    // Si PATH ha cambiado desde que se llenó la tabla, se vacía.
+    const char *pathvar = getenv("PATH");
+    if (pathvar == NULL)
+        pathvar = "";
+    if (hash_pathvar == NULL || strcmp(hash_pathvar, pathvar) != 0){
+        hash_clear();
+        free(hash_pathvar);
+        hash_pathvar = strdup(pathvar);
+    }
+
+    unsigned h = hash_str(name);
+    for (struct hashentry *e = hashtable[h]; e; e = e->next){
+        if (strcmp(e->name, name) == 0){
+            hash_hits++;
+            e->hits++;
+            return e->path;
+        }
+    }
+
+    hash_misses++;
+    char *path = path_search(name);
+    if (path == NULL)
+        return NULL;
+    struct hashentry *e = malloc(sizeof(*e));
+    if (e == NULL){
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    e->name = strdup(name);
+    e->path = path;
+    e->hits = 1;
+    e->next = hashtable[h];
+    hashtable[h] = e;
+    return path;
+}
+
+// Comando interno `hash [-r]`: lista las rutas recordadas con sus usos y
+// los contadores de aciertos y fallos, o vacía la tabla con `-r`.
+void run_hash(struct execcmd *ecmd){
+    if (ecmd->argv[1] != NULL && strcmp(ecmd->argv[1], "-r") == 0){
+        hash_clear();
+        return;
+    }
+    else if (ecmd->argv[1] != NULL){
+        fprintf(stderr, "Uso: hash [-r]\n");
+        return;
+    }
+    fprintf(stdout, "aciertos: %lu, fallos: %lu\n", hash_hits, hash_misses);
+    fprintf(stdout, "usos\torden\n");
+    for (int i = 0; i < HASHSIZE; i++)
+        for (struct hashentry *e = hashtable[i]; e; e = e->next)
+            fprintf(stdout, "%4d\t%s\n", e->hits, e->path);
+}
+
+// Caché de órdenes analizadas
+// -----
+//
+// Las líneas que se repiten no se vuelven a analizar. De cada línea
+// analizada se guarda su árbol en una representación compacta: un único
+// bloque con un vector de instrucciones en postorden y, detrás, las
+// cadenas ya terminadas en '\0'. Cada instrucción empieza por el tipo del
+// nodo (EXEC, REDIR, PIPE, LIST o BACK) seguido de sus operandos:
+//
+//     EXEC  argc, desplazamiento de cada argumento
+//     REDIR desplazamiento del fichero, mode, fd   (sobre el nodo de la cima)
+//     PIPE, LIST                                   (sobre los dos de la cima)
+//     BACK                                         (sobre el nodo de la cima)
+//
+// Reconstruir el árbol es copiar las cadenas a la arena de una vez y
+// recorrer el vector con una pila, sin tokenizar ni `nulterminate()`. El
+// árbol es siempre una copia nueva porque la ejecución lo modifica
+// (prefijos, comodines).
+//
+// Las entradas se buscan por el resumen de 64 bits de la línea en una
+// tabla hash y están en una lista por orden de uso; al llegar a
+// `pcache_max` (SIMPLESH_PCACHE; 0 la desactiva) se descarta la usada
+// hace más tiempo.
+struct pcache_entry {
+    uint64_t hash;
+    char *line;                 // Línea original, para descartar colisiones
+    uint32_t *code;
+    size_t ncode;
+    char *strs;
+    size_t strsize;
+    int nnodes;
+    unsigned long hits;
+    struct pcache_entry *next;  // Cadena de la tabla hash
+    struct pcache_entry *newer; // Lista por orden de uso
+    struct pcache_entry *older;
+};
+
+static struct pcache_entry *pcache_table[PCACHESIZE];
+static struct pcache_entry *pcache_newest = NULL;
+static struct pcache_entry *pcache_oldest = NULL;
+static int pcache_max = PCACHE_ENTRIES;
+static int pcache_count = 0;
+static unsigned long pcache_hits = 0;
+static unsigned long pcache_misses = 0;
+
+// Resumen FNV-1a de 64 bits de los `n` bytes de `s`.
+uint64_t pcache_hash(const char *s, size_t n){
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < n; i++)
+        h = (h ^ (unsigned char)s[i]) * 1099511628211ULL;
+    return h;
+}
+
+// Estado de `pcache_lower()`. Con `code` a NULL sólo se cuenta el
+// tamaño de las instrucciones y de las cadenas.
+struct pcache_ir {
+    uint32_t *code;
+    size_t ncode;
+    char *strs;
+    size_t strsize;
+    int nnodes;
+};
+
+// Añade la cadena `s` y retorna su desplazamiento.
+uint32_t pcache_str(struct pcache_ir *ir, const char *s){
+    size_t off = ir->strsize;
+    size_t len = strlen(s) + 1;
+    if (ir->code != NULL)
+        memcpy(ir->strs + off, s, len);
+    ir->strsize += len;
+    return off;
+}
+
+void pcache_op(struct pcache_ir *ir, uint32_t word){
+    if (ir->code != NULL)
+        ir->code[ir->ncode] = word;
+    ir->ncode++;
+}
+
+// Baja el árbol `cmd` a instrucciones en postorden.
+void pcache_lower(struct cmd *cmd, struct pcache_ir *ir){
+    ir->nnodes++;
+    switch (cmd->type){
+    case EXEC:{
+        struct execcmd *ecmd = (struct execcmd*)cmd;
+        pcache_op(ir, EXEC);
+        pcache_op(ir, ecmd->argc);
+        for (int i = 0; i < ecmd->argc; i++)
+            pcache_op(ir, pcache_str(ir, ecmd->argv[i]));
+        break;
+    }
+    case REDIR:{
+        struct redircmd *rcmd = (struct redircmd*)cmd;
+        pcache_lower(rcmd->cmd, ir);
+        pcache_op(ir, REDIR);
+        pcache_op(ir, pcache_str(ir, rcmd->file));
+        pcache_op(ir, rcmd->mode);
+        pcache_op(ir, rcmd->fd);
+        break;
+    }
+    case PIPE:
+        pcache_lower(((struct pipecmd*)cmd)->left, ir);
+        pcache_lower(((struct pipecmd*)cmd)->right, ir);
+        pcache_op(ir, PIPE);
+        break;
+    case LIST:
+        pcache_lower(((struct listcmd*)cmd)->left, ir);
+        pcache_lower(((struct listcmd*)cmd)->right, ir);
+        pcache_op(ir, LIST);
+        break;
+    case BACK:
+        pcache_lower(((struct backcmd*)cmd)->cmd, ir);
+        pcache_op(ir, BACK);
+        break;
+    }
+}
+
+// Reconstruye en la arena el árbol de `e`.
+struct cmd* pcache_build(const struct pcache_entry *e){
+    char *strs = memcpy(arena_alloc(e->strsize), e->strs, e->strsize);
+    struct cmd **stack = arena_alloc(e->nnodes * sizeof(*stack));
+    int top = 0;
+
+    for (size_t pc = 0; pc < e->ncode; ){
+        switch (e->code[pc++]){
+        case EXEC:{
+            struct execcmd *ecmd = (struct execcmd*)execcmd();
+            uint32_t argc = e->code[pc++];
+            for (uint32_t i = 0; i < argc; i++){
+                char *s = strs + e->code[pc++];
+                execcmd_push(ecmd, s, s + strlen(s));
+            }
+            ecmd->argv[argc] = 0;
+            ecmd->eargv[argc] = 0;
+            stack[top++] = (struct cmd*)ecmd;
+            break;
+        }
+        case REDIR:{
+            char *file = strs + e->code[pc];
+            stack[top - 1] = redircmd(stack[top - 1], file, file + strlen(file),
+                                      e->code[pc + 1], e->code[pc + 2]);
+            pc += 3;
+            break;
+        }
+        case PIPE:
+            top--;
+            stack[top - 1] = pipecmd(stack[top - 1], stack[top]);
+            break;
+        case LIST:
+            top--;
+            stack[top - 1] = listcmd(stack[top - 1], stack[top]);
+            break;
+        case BACK:
+            stack[top - 1] = backcmd(stack[top - 1]);
+            break;
+        }
+    }
+    return stack[0];
+}
+
+// Quita `e` de la lista por orden de uso.
+void pcache_unlink(struct pcache_entry *e){
+    if (e->newer)
+        e->newer->older = e->older;
+    else
+        pcache_newest = e->older;
+    if (e->older)
+        e->older->newer = e->newer;
+    else
+        pcache_oldest = e->newer;
+}
+
+// Pone `e` el primero de la lista por orden de uso.
+void pcache_touch(struct pcache_entry *e){
+    e->newer = NULL;
+    e->older = pcache_newest;
+    if (pcache_newest)
+        pcache_newest->newer = e;
+    pcache_newest = e;
+    if (pcache_oldest == NULL)
+        pcache_oldest = e;
+}
+
+// Saca `e` de la caché y la libera.
+void pcache_evict(struct pcache_entry *e){
+    struct pcache_entry **pe = &pcache_table[e->hash % PCACHESIZE];
+    while (*pe != e)
+        pe = &(*pe)->next;
+    *pe = e->next;
+    pcache_unlink(e);
+    pcache_count--;
+    free(e);
+}
+
+// Vacía la caché.
+void pcache_clear(void){
+    while (pcache_oldest)
+        pcache_evict(pcache_oldest);
+}
+
+// Guarda el árbol `cmd` de la línea `line`, de `len` bytes, en un único
+// bloque: la entrada, las instrucciones, las cadenas y la línea.
+void pcache_insert(uint64_t h, const char *line, size_t len, struct cmd *cmd){
+    struct pcache_ir ir = {0};
+    pcache_lower(cmd, &ir);
+
+    size_t size = sizeof(struct pcache_entry) + ir.ncode * sizeof(uint32_t)
+        + ir.strsize + len + 1;
+    struct pcache_entry *e = malloc(size);
+    if (e == NULL){
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    e->hash = h;
+    e->code = (uint32_t*)(e + 1);
+    e->strs = (char*)(e->code + ir.ncode);
+    e->line = e->strs + ir.strsize;
+    memcpy(e->line, line, len + 1);
+    e->hits = 0;
+
+    ir.code = e->code;
+    ir.strs = e->strs;
+    ir.ncode = ir.strsize = ir.nnodes = 0;
+    pcache_lower(cmd, &ir);
+    e->ncode = ir.ncode;
+    e->strsize = ir.strsize;
+    e->nnodes = ir.nnodes;
+
+    if (pcache_count == pcache_max)
+        pcache_evict(pcache_oldest);
+    e->next = pcache_table[h % PCACHESIZE];
+    pcache_table[h % PCACHESIZE] = e;
+    pcache_touch(e);
+    pcache_count++;
+}
+
+// Como `parse_cmd()`, pero una línea ya vista se reconstruye desde la
+// caché. `buf` se modifica igual que con `parse_cmd()`.
+struct cmd* parse_cached(char *buf){
+    if (pcache_max == 0)
+        return parse_cmd(buf);
+
+    size_t len = strlen(buf);
+    uint64_t h = pcache_hash(buf, len);
+    for (struct pcache_entry *e = pcache_table[h % PCACHESIZE]; e; e = e->next){
+        if (e->hash == h && strcmp(e->line, buf) == 0){
+            pcache_hits++;
+            e->hits++;
+            pcache_unlink(e);
+            pcache_touch(e);
+            arena_parse_start();
+            struct cmd *cmd = pcache_build(e);
+            arena_parse_end();
+            return cmd;
+        }
+    }
+
+    pcache_misses++;
+    // `parse_cmd()` corta `buf` con '\0': se guarda antes la línea.
+    char *line = memcpy(arena_alloc(len + 1), buf, len + 1);
+    struct cmd *cmd = parse_cmd(buf);
+    // Las líneas vacías no se guardan.
+    if (cmd->type != EXEC || ((struct execcmd*)cmd)->argc > 0)
+        pcache_insert(h, line, len, cmd);
+    return cmd;
+}
+
+// Lee el tamaño de la caché de SIMPLESH_PCACHE, si está.
+void pcache_init(void){
+    const char *s = getenv("SIMPLESH_PCACHE");
+    char *end;
+    if (s == NULL)
+        return;
+    long n = strtol(s, &end, 10);
+    if (*s == '\0' || *end != '\0' || n < 0 || n > INT_MAX)
+        fprintf(stderr, "simplesh: SIMPLESH_PCACHE: número de entradas no válido\n");
+    else
+        pcache_max = n;
+}
+
+// Comando interno `pcache [-r]`: muestra los aciertos y fallos de la
+// caché y sus líneas, de la más a la menos usada recientemente, o la
+// vacía con `-r`.
+void run_pcache(struct execcmd *ecmd){
+    if (ecmd->argv[1] != NULL && strcmp(ecmd->argv[1], "-r") == 0){
+        pcache_clear();
+        return;
+    }
+    else if (ecmd->argv[1] != NULL){
+        fprintf(stderr, "Uso: pcache [-r]\n");
+        return;
+    }
+    unsigned long total = pcache_hits + pcache_misses;
+    fprintf(stdout, "aciertos: %lu, fallos: %lu, tasa: %.1f%%\n", pcache_hits,
+            pcache_misses, total ? 100.0 * pcache_hits / total : 0.0);
+    fprintf(stdout, "entradas: %d de %d\n", pcache_count, pcache_max);
+    fprintf(stdout, "usos\tbytes\tlínea\n");
+    for (struct pcache_entry *e = pcache_newest; e; e = e->older)
+        fprintf(stdout, "%4lu\t%zu\t%s\n", e->hits,
+                e->ncode * sizeof(uint32_t) + e->strsize, e->line);
+}
+
+// Indica si `name` es uno de los comandos internos que pueden formar
+// parte de una tubería o de un bloque.
+int is_builtin(char *name){
+    return strcmp(name, "pwd") == 0 || strcmp(name, "tee") == 0
+        || strcmp(name, "du") == 0;
+}
+
+// Indica si `name` es uno de los comandos internos que sólo tienen
+// sentido en el propio shell (ver `exec_line()`): no pueden formar parte
+// de una tubería ni de un bloque.
+int is_shell_builtin(char *name){
+    static char *names[] = {"exit", "cd", "arena", "launcher", "hash", "pcache",
+                            "jobs", "wait", "fg", "cgroup", "acct", NULL};
+    for (int i = 0; names[i]; i++)
+        if (strcmp(name, names[i]) == 0)
+            return 1;
+    return 0;
+}
+
+// Resuelve en el shell las órdenes externas de `cmd` antes de lanzarlo
+// con `fork()`. Las etapas de una tubería o las órdenes de una lista
+// buscan su ruta en el hijo, en su copia de la tabla; así la del shell
+// también se llena con ellas y cuenta sus aciertos y fallos.
+void hash_prefetch(struct cmd *cmd){
+    struct execcmd *ecmd;
+    switch (cmd->type){
+    case EXEC:
+        ecmd = (struct execcmd*)cmd;
+        if (ecmd->argv[0] && !is_builtin(ecmd->argv[0]) && !is_shell_builtin(ecmd->argv[0]))
+            hash_lookup(ecmd->argv[0]);
+        break;
+    case REDIR:
+        hash_prefetch(((struct redircmd*)cmd)->cmd);
+        break;
+    case PIPE:
+    case LIST:
+        // `pipecmd` y `listcmd` tienen la misma forma.
+        hash_prefetch(((struct pipecmd*)cmd)->left);
+        hash_prefetch(((struct pipecmd*)cmd)->right);
+        break;
+    case BACK:
+        hash_prefetch(((struct backcmd*)cmd)->cmd);
+        break;
+    }
+}
+
+// Ejecuta un comando interno y retorna su código de salida.
+int run_builtin(struct execcmd *ecmd){
+    int status = 0;
+    if (strcmp(ecmd->argv[0], "pwd") == 0)
+        status = run_pwd();
+    else if (strcmp(ecmd->argv[0], "tee") == 0)
+        status = run_tee(ecmd);
+    else if (strcmp(ecmd->argv[0], "du") == 0)
+        status = run_du(ecmd);
+    fflush(stdout);
+    return status;
+}
+
+// Si `cmd` es una orden simple, con o sin redirecciones, retorna su
+// `execcmd`; si no (tuberías, listas, bloques u orden vacía), `NULL`.
+struct execcmd* simple_cmd(struct cmd *cmd){
+    while (cmd->type == REDIR)
+        cmd = ((struct redircmd*)cmd)->cmd;
+    if (cmd->type != EXEC || ((struct execcmd*)cmd)->argv[0] == NULL)
+        return NULL;
+    return (struct execcmd*)cmd;
+}
+
+// Si `cmd` es un comando interno, con o sin redirecciones, retorna su
+// `execcmd`; si no, `NULL`.
+struct execcmd* builtin_cmd(struct cmd *cmd){
+    struct execcmd *ecmd = simple_cmd(cmd);
+    if (ecmd == NULL || !is_builtin(ecmd->argv[0]))
+        return NULL;
+    return ecmd;
+}
+
+// Ejecuta un comando interno en el propio proceso del shell, sin `fork()`.
+// Las redirecciones se aplican en el mismo orden que en `run_cmd()`,
+// guardando antes una copia de cada descriptor para restaurarlo al final.
+int run_builtin_inproc(struct cmd *cmd){
+    int saved[MAXREDIRS];
+    int fds[MAXREDIRS];
+    int nsaved = 0;
+    int status = EXIT_FAILURE;
+
+    while (cmd->type == REDIR){
+        struct redircmd *rcmd = (struct redircmd*)cmd;
+        if (nsaved == MAXREDIRS){
+            fprintf(stderr, "simplesh: demasiadas redirecciones\n");
+            goto restore;
+        }
+        // Copia del descriptor original (-1 si estaba cerrado).
+        fds[nsaved] = rcmd->fd;
+        saved[nsaved] = fcntl(rcmd->fd, F_DUPFD_CLOEXEC, 10);
+        nsaved++;
+        int fd = open(rcmd->file, rcmd->mode, S_IRWXU);
+        if (fd < 0){
+            fprintf(stderr, "open %s failed\n", rcmd->file);
+            goto restore;
+        }
+        if (fd != rcmd->fd){
+            dup2(fd, rcmd->fd);
+            close(fd);
+        }
+        cmd = rcmd->cmd;
+    }
+    status = run_builtin((struct execcmd*)cmd);
+
+restore:
+    fflush(stdout);
+    while (nsaved-- > 0){
+        if (saved[nsaved] == -1)
+            close(fds[nsaved]);
+        else{
+            dup2(saved[nsaved], fds[nsaved]);
+            close(saved[nsaved]);
+        }
+    }
+    return status;
+}
+
+// Forma de lanzar las órdenes externas simples desde el shell.
+#define LAUNCH_SPAWN 0 // posix_spawn (clone con CLONE_VM|CLONE_VFORK en glibc)
+#define LAUNCH_FORK  1 // fork + run_cmd, como el resto de órdenes
+static int launcher = LAUNCH_SPAWN;
+// Control de trabajos: el shell es interactivo y tiene el terminal. Sólo
+// entonces cada trabajo es un grupo de procesos propio (ver `fork_job()`).
+static int job_control = 0;
+
+// Comando interno `launcher [spawn|fork]`: muestra o cambia el lanzador
+// de órdenes externas, para poder comparar ambos.
+void run_launcher(struct execcmd *ecmd){
+    if (ecmd->argv[1] == NULL)
+        fprintf(stdout, "%s\n", launcher == LAUNCH_SPAWN ? "spawn" : "fork");
+    else if (strcmp(ecmd->argv[1], "spawn") == 0)
+        launcher = LAUNCH_SPAWN;
+    else if (strcmp(ecmd->argv[1], "fork") == 0)
+        launcher = LAUNCH_FORK;
+    else
+        fprintf(stderr, "Uso: launcher [spawn|fork]\n");
+}
+
+// Lanza una orden externa simple con `posix_spawnp()`. Como no se copia
+// el espacio de direcciones del shell, el coste no depende de su tamaño.
+// Los ficheros de las redirecciones se abren en el shell, en el mismo
+// orden en que las aplica `run_cmd()`, y se pasan al hijo con `dup2`:
+// así un fichero que no existe se distingue de una orden que no existe.
+// Retorna el PID del hijo o -1.
+int spawn_cmd(struct cmd *cmd){
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    struct execcmd *ecmd = simple_cmd(cmd);
+    int fds[MAXREDIRS];
+    int nfds = 0;
+    int pid, err;
+
+    if ((err = posix_spawn_file_actions_init(&actions)) != 0){
+        fprintf(stderr, "posix_spawn_file_actions_init: %s\n", strerror(err));
+        return -1;
+    }
+    // Como con `fork_job()`, con control de trabajos el hijo tiene su
+    // propio grupo de procesos.
+    posix_spawnattr_init(&attr);
+    if (job_control){
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+        posix_spawnattr_setpgroup(&attr, 0);
+    }
+    for (; cmd->type == REDIR; cmd = ((struct redircmd*)cmd)->cmd){
+        struct redircmd *rcmd = (struct redircmd*)cmd;
+        if (nfds == MAXREDIRS){
+            fprintf(stderr, "simplesh: demasiadas redirecciones\n");
+            err = -1;
+            break;
+        }
+        // Boletin 2, ejercicio 1. Los ficheros se crean con permisos 700.
+        if ((fds[nfds] = open(rcmd->file, rcmd->mode | O_CLOEXEC, S_IRWXU)) < 0){
+            fprintf(stderr, "open %s failed\n", rcmd->file);
+            err = -1;
+            break;
+        }
+        if ((err = posix_spawn_file_actions_adddup2(&actions, fds[nfds++], rcmd->fd)) != 0)
+            break;
+    }
+    if (err == 0){
+        char *path = hash_lookup(ecmd->argv[0]);
+        if (path == NULL)
+            err = ENOENT;
+        else
+            err = posix_spawn(&pid, path, &actions, &attr, ecmd->argv, environ);
+        // La ruta recordada ya no existe: se olvida y se busca de nuevo.
+        if (err == ENOENT && path != NULL && path != ecmd->argv[0]){
+            hash_remove(ecmd->argv[0]);
+            if ((path = hash_lookup(ecmd->argv[0])) != NULL)
+                err = posix_spawn(&pid, path, &actions, &attr, ecmd->argv, environ);
+        }
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    while (nfds-- > 0)
+        close(fds[nfds]);
+    // Con -1 ya se ha dado el error de la redirección.
+    if (err != 0){
+        if (err != -1)
+            fprintf(stderr, "simplesh: no se pudo lanzar %s: %s\n", ecmd->argv[0], strerror(err));
+        return -1;
+    }
+    if (job_control)
+        setpgid(pid, pid);
+    return pid;
+}
+
+// Ejecuta una tubería de N etapas. `parse_pipe()` construye un árbol
+// anidado por la derecha; aquí se aplana en un vector de etapas, se crean
+// todas las tuberías de antemano y el mismo proceso lanza todas las
+// etapas y espera a cada una, sin procesos intermedios.
+void run_pipeline(struct pipecmd *pcmd){
+    struct cmd *cmd;
+    int n = 1;
+    for (cmd = (struct cmd*)pcmd; cmd->type == PIPE; cmd = ((struct pipecmd*)cmd)->right)
+        n++;
+
+    struct cmd *stages[n];
+    int p[n - 1][2];
+    int pids[n];
+    int i = 0;
+    for (cmd = (struct cmd*)pcmd; cmd->type == PIPE; cmd = ((struct pipecmd*)cmd)->right)
+        stages[i++] = ((struct pipecmd*)cmd)->left;
+    stages[i] = cmd;
+
+    for (i = 0; i < n - 1; i++)
+        if (pipe(p[i]) < 0)
+            panic("pipe");
+
+    for (i = 0; i < n; i++){
+        if ((pids[i] = fork1()) == 0){
+            // La etapa i lee de la tubería i-1 y escribe en la i.
+            if (i > 0)
+                dup2(p[i - 1][0], 0);
+            if (i < n - 1)
+                dup2(p[i][1], 1);
+            for (int j = 0; j < n - 1; j++){
+                close(p[j][0]);
+                close(p[j][1]);
+            }
+            run_cmd(stages[i]);
+        }
+    }
+    for (i = 0; i < n - 1; i++){
+        close(p[i][0]);
+        close(p[i][1]);
+    }
+
+    // Esperar a todas las etapas
+    for (i = 0; i < n; i++)
+        waitpid(pids[i], NULL, 0);
+}
+
+// Ejecuta un 'cmd'. Nunca retorna, ya que siempre se ejecuta en un
+// hijo lanzado con 'fork()'.
+void run_cmd(struct cmd *cmd){
+    struct backcmd *bcmd;
+    struct execcmd *ecmd;
+    struct listcmd *lcmd;
+    struct pipecmd *pcmd;
+    struct redircmd *rcmd;
+
+    if(cmd == 0)
+        exit(0);
+
+    switch(cmd->type)
+    {
+    default:
+        panic("run_cmd");
+
+        // Ejecución de una única orden.
+    case EXEC:
+        ecmd = (struct execcmd*)cmd;
+        if (ecmd->argv[0] == 0)
+            exit(0);
+        else if (is_builtin(ecmd->argv[0]))
+            exit(run_builtin(ecmd));
+        // `exit` en un bloque sólo termina el bloque.
+        else if (strcmp(ecmd->argv[0], "exit") == 0)
+            exit(0);
+        else if (is_shell_builtin(ecmd->argv[0])){
+            fprintf(stderr, "simplesh: %s: no se puede usar en una tubería ni en un bloque\n",
+                    ecmd->argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        else{
+            char *path = hash_lookup(ecmd->argv[0]);
+            if (path != NULL)
+                execv(path, ecmd->argv);
+            // Ruta obsoleta o fichero sin formato ejecutable: se deja que
+            // execvp() haga la búsqueda completa.
+            execvp(ecmd->argv[0], ecmd->argv);
+            // Si se llega aquí algo falló (E2BIG si se supera ARG_MAX).
+            fprintf(stderr, "exec %s failed: %s\n", ecmd->argv[0], strerror(errno));
+            exit (1);
+        }
+        break;
+
+    case REDIR:
+        rcmd = (struct redircmd*)cmd;
+        close(rcmd->fd);
+        // Boletin 2, ejercicio 1. Añadimos los permisos para que los ficheros
+        // se creen con permisos 700.
+        if (open(rcmd->file, rcmd->mode, S_IRWXU) < 0)
+        {
+            fprintf(stderr, "open %s failed\n", rcmd->file);
+            exit(1);
+        }
+        run_cmd(rcmd->cmd);
+        break;
+
+    case LIST:
+        lcmd = (struct listcmd*)cmd;
+        if (fork1() == 0)
+            run_cmd(lcmd->left);
+        wait(NULL);
+        run_cmd(lcmd->right);
+        break;
+
+    case PIPE:
+        pcmd = (struct pipecmd*)cmd;
+        run_pipeline(pcmd);
+        break;
+
+    case BACK:
+        bcmd = (struct backcmd*)cmd;
+        if (fork1() == 0)
+            run_cmd(bcmd->cmd);
+        break;
+    }
+
+    // Salida normal, código 0.
+    exit(0);
+}
+
+// Expansión de comodines
+// -----
+//
+// Antes de ejecutar cada línea, los argumentos con `*`, `?` o `[...]` se
+// sustituyen por las rutas que encajan, ordenadas, directamente en el
+// `argv` de su orden. Si no encaja ninguna, el argumento se deja tal
+// cual. Como en sh, los nombres que empiezan por '.' sólo encajan con un
+// componente que empiece por '.', y nunca se devuelven `.` ni `..`.
+//
+// Cada componente del patrón se compila a un vector de posiciones, cada
+// una un `*` o un conjunto de 256 bits con los caracteres que admite. Un
+// nombre se compara con todas las posiciones alcanzables a la vez (como
+// un autómata no determinista), sin vuelta atrás: el coste es lineal en
+// el nombre por el tamaño del patrón, sea cual sea el número de `*`.
+//
+// Cada directorio se lee una sola vez por línea con getdents64 y su
+// lista de nombres, ordenada, queda en la arena para los demás patrones
+// de la línea que pasen por él.
+struct glob_tok {
+    int star;           // `*`: cualquier secuencia de caracteres
+    uint64_t set[4];    // Si no, los caracteres que encajan
+};
+
+struct glob_pat {
+    int n;
+    int dot;            // Empieza por '.' y encaja con nombres ocultos
+    struct glob_tok tok[];
+};
+
+struct glob_ent {
+    char *name;
+    unsigned char type;
+};
+
+struct glob_dir {
+    char *path;
+    struct glob_ent *ents;
+    int n;
+    struct glob_dir *next;
+};
+
+// Directorios leídos en la línea actual.
+static struct glob_dir *glob_dirs = NULL;
+
+// Indica si los `n` primeros caracteres de `s` tienen algún comodín.
+int glob_meta(const char *s, size_t n){
+    for (size_t i = 0; i < n; i++)
+        if (s[i] == '*' || s[i] == '?' || s[i] == '[')
+            return 1;
+    return 0;
+}
+
+// Compila el componente de `n` caracteres `s`. Un '[' sin cerrar se
+// toma como literal.
+struct glob_pat* glob_compile(const char *s, size_t n){
+    struct glob_pat *p = arena_alloc(sizeof(*p) + n * sizeof(struct glob_tok));
+    p->dot = n > 0 && s[0] == '.';
+    for (size_t i = 0; i < n; i++){
+        // `**` equivale a `*`.
+        if (s[i] == '*' && p->n > 0 && p->tok[p->n - 1].star)
+            continue;
+        struct glob_tok *t = &p->tok[p->n++];
+        if (s[i] == '*'){
+            t->star = 1;
+            continue;
+        }
+        if (s[i] == '?'){
+            memset(t->set, 0xff, sizeof(t->set));
+            continue;
+        }
+        if (s[i] == '['){
+            size_t j = i + 1;
+            int neg = j < n && (s[j] == '!' || s[j] == '^');
+            if (neg)
+                j++;
+            // Un ']' justo tras '[' o '[!' es un carácter más.
+            size_t first = j;
+            while (j < n && (s[j] != ']' || j == first))
+                j++;
+            if (j < n){
+                for (size_t k = first; k < j; k++){
+                    unsigned char lo = s[k], hi = s[k];
+                    if (k + 2 < j && s[k + 1] == '-'){
+                        hi = s[k + 2];
+                        k += 2;
+                    }
+                    for (unsigned c = lo; c <= hi; c++)
+                        t->set[c >> 6] |= 1ULL << (c & 63);
+                }
+                if (neg)
+                    for (int w = 0; w < 4; w++)
+                        t->set[w] = ~t->set[w];
+                i = j;
+                continue;
+            }
+        }
+        unsigned char c = s[i];
+        t->set[c >> 6] |= 1ULL << (c & 63);
+    }
+    return p;
+}
+
+// Indica si `name` encaja con `p`. `cur` tiene las posiciones del patrón
+// alcanzables tras los caracteres ya leídos; la posición `p->n` es la de
+// aceptación.
+int glob_match(const struct glob_pat *p, const char *name){
+    int words = p->n / 64 + 1;
+    uint64_t cur[words], next[words];
+
+    if (name[0] == '.' && !p->dot)
+        return 0;
+    memset(cur, 0, sizeof(cur));
+    cur[0] = 1;
+    for (const unsigned char *c = (const unsigned char*)name; ; c++){
+        // Un `*` también encaja con la secuencia vacía: se puede pasar a
+        // la posición siguiente sin leer nada.
+        for (int i = 0; i < p->n; i++)
+            if (p->tok[i].star && (cur[i >> 6] >> (i & 63) & 1))
+                cur[(i + 1) >> 6] |= 1ULL << ((i + 1) & 63);
+        if (*c == '\0')
+            return cur[p->n >> 6] >> (p->n & 63) & 1;
+        memset(next, 0, sizeof(next));
+        int alive = 0;
+        for (int i = 0; i < p->n; i++){
+            if (!(cur[i >> 6] >> (i & 63) & 1))
+                continue;
+            const struct glob_tok *t = &p->tok[i];
+            int to = i + 1;
+            if (t->star)
+                to = i;
+            else if (!(t->set[*c >> 6] >> (*c & 63) & 1))
+                continue;
+            next[to >> 6] |= 1ULL << (to & 63);
+            alive = 1;
+        }
+        if (!alive)
+            return 0;
+        memcpy(cur, next, sizeof(cur));
+    }
+}
+
+int glob_ent_cmp(const void *a, const void *b){
+    return strcmp(((const struct glob_ent*)a)->name, ((const struct glob_ent*)b)->name);
+}
+
+// Retorna la lista ordenada de nombres de `path` ("" es el directorio
+// actual), leyéndola si es la primera vez en esta línea. NULL si no se
+// puede abrir.
+struct glob_dir* glob_readdir(const char *path){
+    struct glob_dir *d;
+    for (d = glob_dirs; d != NULL; d = d->next)
+        if (strcmp(d->path, path) == 0)
+            return d->ents ? d : NULL;
+
+    d = arena_alloc(sizeof(*d));
+    d->path = strcpy(arena_alloc(strlen(path) + 1), path);
+    d->next = glob_dirs;
+    glob_dirs = d;
+    int dfd = open(*path ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd == -1)
+        return NULL;
+
+    char buf[DU_DENTSIZE];
+    int cap = 0;
+    long nread;
+    while ((nread = syscall(SYS_getdents64, dfd, buf, sizeof(buf))) > 0){
+        for (long off = 0; off < nread; ){
+            struct linux_dirent64 {
+                uint64_t d_ino;
+                int64_t d_off;
+                unsigned short d_reclen;
+                unsigned char d_type;
+                char d_name[];
+            } *de = (struct linux_dirent64*)(buf + off);
+            off += de->d_reclen;
+            if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+                continue;
+            if (d->n == cap){
+                cap = cap ? 2 * cap : 64;
+                struct glob_ent *ents = arena_alloc(cap * sizeof(*ents));
+                if (d->n)
+                    memcpy(ents, d->ents, d->n * sizeof(*ents));
+                d->ents = ents;
+            }
+            size_t len = strlen(de->d_name);
+            d->ents[d->n].name = memcpy(arena_alloc(len + 1), de->d_name, len + 1);
+            d->ents[d->n].type = de->d_type;
+            d->n++;
+        }
+    }
+    close(dfd);
+    // Un directorio vacío se recuerda igual, con un vector vacío.
+    if (d->ents == NULL)
+        d->ents = arena_alloc(sizeof(*d->ents));
+    qsort(d->ents, d->n, sizeof(*d->ents), glob_ent_cmp);
+    return d;
+}
+
+// Une `base` y el componente de `n` caracteres `s` en la arena.
+char* glob_join(const char *base, const char *s, size_t n){
+    size_t blen = strlen(base);
+    int sep = blen > 0 && base[blen - 1] != '/';
+    char *path = arena_alloc(blen + sep + n + 1);
+    memcpy(path, base, blen);
+    if (sep)
+        path[blen] = '/';
+    memcpy(path + blen + sep, s, n);
+    return path;
+}
+
+// Indica si `path`, cuyo tipo según getdents64 es `type`, es un
+// directorio. Los enlaces simbólicos se siguen, como en sh.
+int glob_isdir(const char *path, unsigned char type){
+    struct stat sb;
+    if (type == DT_DIR)
+        return 1;
+    if (type != DT_LNK && type != DT_UNKNOWN)
+        return 0;
+    return stat(path, &sb) == 0 && S_ISDIR(sb.st_mode);
+}
+
+// Añade a `cmd` las rutas que encajan con el resto del patrón `s` dentro
+// de `base`. Con `dir` sólo valen los directorios (el patrón acababa en
+// '/'). Retorna cuántas se han añadido.
+int glob_expand(struct execcmd *cmd, const char *base, const char *s, int dir){
+    while (*s == '/')
+        s++;
+    if (*s == '\0'){
+        if (dir && !glob_isdir(base, DT_UNKNOWN))
+            return 0;
+        size_t len = strlen(base);
+        char *path = arena_alloc(len + 2);
+        memcpy(path, base, len);
+        if (dir && len > 0 && base[len - 1] != '/')
+            path[len] = '/';
+        execcmd_push(cmd, path, path + strlen(path));
+        return 1;
+    }
+    size_t n = strcspn(s, "/");
+    const char *rest = s + n;
+    // Los componentes sin comodines no hace falta buscarlos; si no
+    // existen, fallará la lectura del directorio o la comprobación final.
+    if (!glob_meta(s, n)){
+        char *path = glob_join(base, s, n);
+        struct stat sb;
+        if (rest[strspn(rest, "/")] == '\0' && lstat(path, &sb) == -1)
+            return 0;
+        return glob_expand(cmd, path, rest, dir);
+    }
+
+    struct glob_dir *d = glob_readdir(base);
+    if (d == NULL)
+        return 0;
+    struct glob_pat *p = glob_compile(s, n);
+    int last = rest[strspn(rest, "/")] == '\0';
+    int found = 0;
+    for (int i = 0; i < d->n; i++){
+        if (!glob_match(p, d->ents[i].name))
+            continue;
+        char *path = glob_join(base, d->ents[i].name, strlen(d->ents[i].name));
+        if (!last && !glob_isdir(path, d->ents[i].type))
+            continue;
+        found += glob_expand(cmd, path, rest, dir);
+    }
+    return found;
+}
+
+// Expande los comodines de los argumentos de `ecmd`. El vector se
+// reconstruye en la arena; los argumentos sin comodines se copian tal
+// cual.
+void glob_exec(struct execcmd *ecmd){
+    int argc = ecmd->argc;
+    char **argv = ecmd->argv;
+    char **eargv = ecmd->eargv;
+    int i;
+
+    for (i = 0; i < argc; i++)
+        if (glob_meta(argv[i], strlen(argv[i])))
+            break;
+    if (i == argc)
+        return;
+
+    ecmd->argc = 0;
+    ecmd->cap = ARGVSIZE;
+    ecmd->argv = arena_alloc(ARGVSIZE * sizeof(char*));
+    ecmd->eargv = arena_alloc(ARGVSIZE * sizeof(char*));
+    for (i = 0; i < argc; i++){
+        char *s = argv[i];
+        size_t len = strlen(s);
+        if (glob_meta(s, len) &&
+            glob_expand(ecmd, *s == '/' ? "/" : "", s, len > 1 && s[len - 1] == '/') > 0)
+            continue;
+        execcmd_push(ecmd, s, eargv[i]);
+    }
+    ecmd->argv[ecmd->argc] = NULL;
+    ecmd->eargv[ecmd->argc] = NULL;
+}
+
+// Expande los comodines de todas las órdenes simples de `cmd`. La caché
+// de directorios sólo vale para esta línea.
+void glob_cmd_rec(struct cmd *cmd){
+    switch (cmd->type){
+    case EXEC:
+        glob_exec((struct execcmd*)cmd);
+        break;
+    case REDIR:
+        glob_cmd_rec(((struct redircmd*)cmd)->cmd);
+        break;
+    case PIPE:
+        glob_cmd_rec(((struct pipecmd*)cmd)->left);
+        glob_cmd_rec(((struct pipecmd*)cmd)->right);
+        break;
+    case LIST:
+        glob_cmd_rec(((struct listcmd*)cmd)->left);
+        glob_cmd_rec(((struct listcmd*)cmd)->right);
+        break;
+    case BACK:
+        glob_cmd_rec(((struct backcmd*)cmd)->cmd);
+        break;
+    }
+}
+
+void glob_cmd(struct cmd *cmd){
+    glob_dirs = NULL;
+    glob_cmd_rec(cmd);
+}
+
+// Cgroups de los trabajos
+// -----
+
+// Con `cgroup on` y cgroup v2, cada trabajo se ejecuta en su propio
+// cgroup, creado dentro de uno del shell (`simplesh.PID`) que cuelga del
+// cgroup en el que se arrancó. Matar el trabajo es entonces escribir en
+// su `cgroup.kill`, y no se escapa ningún proceso aunque cambie de grupo
+// de procesos o de sesión.
+static int cg_enabled = 0;
+static char *cg_base = NULL;
+static unsigned cg_seq = 0;
+
+int cg_write(const char *dir, const char *file, const char *val){
+    char path[PATH_MAX];
+    int fd, ret = 0;
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    if ((fd = open(path, O_WRONLY | O_CLOEXEC)) == -1)
+        return -1;
+    if (write(fd, val, strlen(val)) == -1)
+        ret = -1;
+    close(fd);
+    return ret;
+}
+
+// Crea el cgroup de un trabajo nuevo. Retorna su ruta o NULL.
+char* cg_create(void){
+    char path[PATH_MAX];
+    if (!cg_enabled)
+        return NULL;
+    snprintf(path, sizeof(path), "%s/%u", cg_base, cg_seq++);
+    if (mkdir(path, 0755) == -1){
+        perror(path);
+        return NULL;
+    }
+    return strdup(path);
+}
+
+// Mata todos los procesos del cgroup `cg`. Sin `cgroup.kill` (antes de
+// Linux 5.14) se recorre `cgroup.procs`.
+void cg_kill(const char *cg){
+    char path[PATH_MAX];
+    FILE *procs;
+    int pid;
+    if (cg_write(cg, "cgroup.kill", "1") == 0)
+        return;
+    snprintf(path, sizeof(path), "%s/cgroup.procs", cg);
+    if ((procs = fopen(path, "r")) == NULL)
+        return;
+    while (fscanf(procs, "%d", &pid) == 1)
+        kill(pid, SIGKILL);
+    fclose(procs);
+}
+
+// Borra el cgroup `cg` de un trabajo ya terminado. Si aún quedan procesos
+// dentro no se puede; se intentará de nuevo al salir.
+void cg_remove(char *cg){
+    rmdir(cg);
+    free(cg);
+}
+
+void cg_cleanup(void){
+    DIR *dir;
+    struct dirent *de;
+    char path[PATH_MAX];
+    if (cg_base == NULL || (dir = opendir(cg_base)) == NULL)
+        return;
+    while ((de = readdir(dir)) != NULL)
+        if (de->d_type == DT_DIR && de->d_name[0] != '.'){
+            snprintf(path, sizeof(path), "%s/%s", cg_base, de->d_name);
+            rmdir(path);
+        }
+    closedir(dir);
+    rmdir(cg_base);
+}
+
+// Prepara el cgroup del shell. Retorna -1 si no hay cgroup v2 o no se
+// puede escribir en él.
+int cg_init(void){
+    // `path` tiene sitio para la ruta de `line` con el prefijo y el sufijo.
+    char line[PATH_MAX], path[PATH_MAX + 64];
+    FILE *self;
+    int found = 0;
+    if (cg_base != NULL)
+        return 0;
+    if (access("/sys/fs/cgroup/cgroup.controllers", F_OK) == -1){
+        fprintf(stderr, "simplesh: cgroup: no hay cgroup v2 en /sys/fs/cgroup\n");
+        return -1;
+    }
+    if ((self = fopen("/proc/self/cgroup", "r")) == NULL){
+        perror("/proc/self/cgroup");
+        return -1;
+    }
+    while (!found && fgets(line, sizeof(line), self) != NULL)
+        found = strncmp(line, "0::", 3) == 0;
+    fclose(self);
+    if (!found)
+        return -1;
+    line[strcspn(line, "\n")] = '\0';
+    if (snprintf(path, sizeof(path), "/sys/fs/cgroup%s/simplesh.%d",
+                strcmp(line + 3, "/") == 0 ? "" : line + 3, getpid()) >= (int) sizeof(path)){
+        fprintf(stderr, "simplesh: cgroup: ruta demasiado larga\n");
+        return -1;
+    }
+    if (mkdir(path, 0755) == -1 && errno != EEXIST){
+        perror(path);
+        return -1;
+    }
+    cg_base = strdup(path);
+    atexit(cg_cleanup);
+    return 0;
+}
+
+// `cgroup [on|off]`: usar o no un cgroup por trabajo.
+void run_cgroup(struct execcmd *ecmd){
+    if (ecmd->argv[1] == NULL)
+        fprintf(stdout, "%s\n", cg_enabled ? "on" : "off");
+    else if (strcmp(ecmd->argv[1], "on") == 0)
+        cg_enabled = cg_init() == 0;
+    else if (strcmp(ecmd->argv[1], "off") == 0)
+        cg_enabled = 0;
+    else
+        fprintf(stderr, "Uso: cgroup [on|off]\n");
+}
+
+// Trabajos y supervisión de hijos
+// -----
+
+// Todos los hijos que espera el shell, en primer o segundo plano, están
+// en una tabla de trabajos. Cada uno tiene un pidfd registrado en un
+// único epoll y, si lo tiene, un plazo en milisegundos del reloj
+// monótono. `children_wait()` espera a la vez en el epoll y hasta el plazo
+// más cercano: un hijo que termina sólo despierta al que lo espera a
+// través de su pidfd, y cada hijo se mata al vencer su propio plazo. Si
+// el núcleo no tiene pidfd, se comprueba cada CHILD_POLLMS.
+//
+// Cada hijo se recoge con `wait4()`, que da también sus recursos y los
+// de los hijos que él haya esperado: las etapas de una tubería o las
+// órdenes de una lista quedan así sumadas en su trabajo. Con el prefijo
+// `time` se imprimen al terminar, y con `acct FICHERO` (o la variable
+// SIMPLESH_ACCT) se añaden los de cada trabajo a un registro.
+//
+// En el shell interactivo con terminal (control de trabajos) cada trabajo
+// es un grupo de procesos propio y, con `cgroup on`, un cgroup propio, así
+// que al vencer el plazo se mata el árbol entero: las etapas de una
+// tubería, las órdenes de una lista o lo que el trabajo haya dejado en
+// segundo plano. Sin control de trabajos (guiones, `-c` o entrada que no
+// es un terminal) los hijos se quedan en el grupo del shell, como en
+// otros shells: así pueden leer del terminal sin que éste cambie de
+// grupo, y sólo con `cgroup on` se mata algo más que el propio hijo.
+//
+// Mientras readline espera una tecla se espera también en el epoll, de
+// modo que los trabajos en segundo plano se recogen al terminar sin
+// bloquear el *prompt*. El aviso se imprime antes del siguiente.
+//
+// El pidfd sólo avisa cuando el hijo termina, no cuando se para (Ctrl-Z,
+// SIGTTIN) o continúa. Para eso hace falta SIGCHLD, cuyo manejador
+// escribe en una tubería que está en el mismo epoll, y los hijos se
+// recogen con WUNTRACED y WCONTINUED. El manejador sólo está instalado
+// mientras se espera a un trabajo (`job_wait()`): en el *prompt* cada
+// hijo que termina despierta sólo a través de su pidfd, y los que se
+// paran se ven al recogerlos antes del siguiente. Una orden en primer
+// plano que se para pasa a ser un trabajo parado y el shell recupera el
+// terminal; su plazo sólo corre mientras se ejecuta.
+#define JOB_RUNNING 0
+#define JOB_DONE    1
+#define JOB_STOPPED 2
+#define CHILD_POLLMS 50
+
+struct job {
+    int id;         // 0 en la orden en primer plano
+    int pid;
+    int pidfd;      // -1 si no se ha podido abrir
+    int state;
+    int status;     // Estado de `waitpid()` al terminar
+    long long deadline; // Plazo en ms del reloj monótono, 0 si no tiene
+    long long left;     // Parado: ms que le quedaban de plazo, 0 si no tenía
+    char *cgroup;   // Ruta de su cgroup, NULL si no tiene
+    char *text;     // La orden, para `jobs`
+    int timed;      // Prefijo `time`
+    struct timespec start, end;
+    struct rusage ru;
+};
+
+static struct job *jobs = NULL;
+static int njobs = 0;
+static int capjobs = 0;
+static int child_epfd = -1;
+static int child_pipe[2] = {-1, -1}; // SIGCHLD: algún hijo ha cambiado de estado
+static int count = 0; // Hijos recogidos
+static FILE *acct_file = NULL;  // Registro de recursos de la sesión
+static char *acct_path = NULL;
+
+long long now_ms(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// Tiempo transcurrido entre `a` y `b`, en segundos.
+double ts_diff(const struct timespec *a, const struct timespec *b){
+    return (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+double tv_secs(const struct timeval *tv){
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+// Imprime en stderr los recursos usados por `job` (prefijo `time`).
+void job_times(struct job *job){
+    struct rusage *ru = &job->ru;
+    fprintf(stderr, "real %.3fs user %.3fs sys %.3fs maxrss %ldKB csw %ld/%ld io %ld/%ld\t%s\n",
+            ts_diff(&job->start, &job->end), tv_secs(&ru->ru_utime), tv_secs(&ru->ru_stime),
+            ru->ru_maxrss, ru->ru_nvcsw, ru->ru_nivcsw, ru->ru_inblock, ru->ru_oublock, job->text);
+}
+
+// Añade una línea al registro de la sesión por cada trabajo terminado.
+// Campos separados por tabuladores: fin (segundos desde 1970), PID,
+// estado (código de salida, o 128 + señal), real, user y sys en
+// segundos, RSS máximo en KB, cambios de contexto voluntarios e
+// involuntarios, bloques leídos y escritos y la orden.
+void acct_log(struct job *job){
+    struct rusage *ru = &job->ru;
+    if (acct_file == NULL)
+        return;
+    fprintf(acct_file, "%ld\t%d\t%d\t%.6f\t%.6f\t%.6f\t%ld\t%ld\t%ld\t%ld\t%ld\t%s\n",
+            (long) time(NULL), job->pid,
+            WIFSIGNALED(job->status) ? 128 + WTERMSIG(job->status) : WEXITSTATUS(job->status),
+            ts_diff(&job->start, &job->end), tv_secs(&ru->ru_utime), tv_secs(&ru->ru_stime),
+            ru->ru_maxrss, ru->ru_nvcsw, ru->ru_nivcsw, ru->ru_inblock, ru->ru_oublock, job->text);
+    fflush(acct_file);
+}
+
+// Abre `path` como registro de la sesión; NULL lo cierra.
+void acct_open(const char *path){
+    if (acct_file != NULL)
+        fclose(acct_file);
+    acct_file = NULL;
+    free(acct_path);
+    acct_path = NULL;
+    if (path == NULL)
+        return;
+    if ((acct_file = fopen(path, "ae")) == NULL){
+        perror(path);
+        return;
+    }
+    acct_path = strdup(path);
+}
+
+// `acct [FICHERO|off]`: registro de recursos de los trabajos.
+void run_acct(struct execcmd *ecmd){
+    if (ecmd->argv[1] == NULL)
+        fprintf(stdout, "%s\n", acct_path ? acct_path : "off");
+    else if (strcmp(ecmd->argv[1], "off") == 0)
+        acct_open(NULL);
+    else
+        acct_open(ecmd->argv[1]);
+}
+
+// Crea, la primera vez, el epoll de los hijos con la tubería de SIGCHLD.
+void child_epoll(void){
+    struct epoll_event ev = { .events = EPOLLIN };
+    if (child_epfd != -1)
+        return;
+    if ((child_epfd = epoll_create1(EPOLL_CLOEXEC)) == -1){
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+    if (pipe2(child_pipe, O_NONBLOCK | O_CLOEXEC) == -1){
+        perror("pipe2");
+        exit(EXIT_FAILURE);
+    }
+    ev.data.fd = child_pipe[0];
+    if (epoll_ctl(child_epfd, EPOLL_CTL_ADD, child_pipe[0], &ev) == -1){
+        perror("epoll_ctl");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Manejador de SIGCHLD durante `job_wait()`: despierta a
+// `children_wait()`. Si la tubería está llena ya hay un aviso pendiente.
+static void sigchld_handler(int sig){
+    int saved = errno;
+    ssize_t r = write(child_pipe[1], "", 1);
+    (void) r;
+    errno = saved;
+}
+
+// Añade a `buf` una versión legible de `cmd`.
+void cmd_text(struct cmd *cmd, char *buf, size_t size){
+    size_t len = strlen(buf);
+    struct redircmd *rcmd;
+    struct execcmd *ecmd;
+
+    switch(cmd->type)
+    {
+    case EXEC:
+        ecmd = (struct execcmd*)cmd;
+        for (int i = 0; ecmd->argv[i]; i++){
+            snprintf(buf + len, size - len, "%s%s", i ? " " : "", ecmd->argv[i]);
+            len += strlen(buf + len);
+        }
+        break;
+
+    case REDIR:
+        rcmd = (struct redircmd*)cmd;
+        cmd_text(rcmd->cmd, buf, size);
+        len = strlen(buf);
+        snprintf(buf + len, size - len, " %s %s", rcmd->fd == 0 ? "<" :
+                (rcmd->mode & O_APPEND) ? ">>" : ">", rcmd->file);
+        break;
+
+    case PIPE:
+    case LIST:
+        // `pipecmd` y `listcmd` tienen la misma forma.
+        cmd_text(((struct pipecmd*)cmd)->left, buf, size);
+        len = strlen(buf);
+        snprintf(buf + len, size - len, cmd->type == PIPE ? " | " : " ; ");
+        cmd_text(((struct pipecmd*)cmd)->right, buf, size);
+        break;
+
+    case BACK:
+        cmd_text(((struct backcmd*)cmd)->cmd, buf, size);
+        len = strlen(buf);
+        snprintf(buf + len, size - len, " &");
+        break;
+    }
+}
+
+// Recursos de un comando interno que se ejecuta en el propio shell con
+// el prefijo `time`, como `time wait`: lo que usan el shell y los hijos
+// que recoge mientras tanto, según getrusage().
+struct shell_usage {
+    struct timespec start;
+    struct rusage self, children;
+};
+
+void shell_usage_start(struct shell_usage *u){
+    clock_gettime(CLOCK_MONOTONIC, &u->start);
+    getrusage(RUSAGE_SELF, &u->self);
+    getrusage(RUSAGE_CHILDREN, &u->children);
+}
+
+// Imprime lo usado desde `shell_usage_start(u)` por la orden `cmd`.
+void shell_usage_print(struct shell_usage *u, struct cmd *cmd){
+    struct job job = {0};
+    struct rusage self, children;
+    struct timeval d;
+    char text[MAXPATH] = "";
+
+    clock_gettime(CLOCK_MONOTONIC, &job.end);
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+    job.start = u->start;
+    timersub(&self.ru_utime, &u->self.ru_utime, &job.ru.ru_utime);
+    timersub(&children.ru_utime, &u->children.ru_utime, &d);
+    timeradd(&job.ru.ru_utime, &d, &job.ru.ru_utime);
+    timersub(&self.ru_stime, &u->self.ru_stime, &job.ru.ru_stime);
+    timersub(&children.ru_stime, &u->children.ru_stime, &d);
+    timeradd(&job.ru.ru_stime, &d, &job.ru.ru_stime);
+    job.ru.ru_maxrss = self.ru_maxrss > children.ru_maxrss ? self.ru_maxrss : children.ru_maxrss;
+    job.ru.ru_nvcsw = self.ru_nvcsw - u->self.ru_nvcsw + children.ru_nvcsw - u->children.ru_nvcsw;
+    job.ru.ru_nivcsw = self.ru_nivcsw - u->self.ru_nivcsw + children.ru_nivcsw - u->children.ru_nivcsw;
+    job.ru.ru_inblock = self.ru_inblock - u->self.ru_inblock + children.ru_inblock - u->children.ru_inblock;
+    job.ru.ru_oublock = self.ru_oublock - u->self.ru_oublock + children.ru_oublock - u->children.ru_oublock;
+    cmd_text(cmd, text, sizeof(text));
+    job.text = text;
+    job_times(&job);
+}
+
+// Número para un trabajo nuevo: uno más que el mayor de la tabla.
+int job_next_id(void){
+    int id = 0;
+    for (int i = 0; i < njobs; i++)
+        if (jobs[i].id > id)
+            id = jobs[i].id;
+    return id + 1;
+}
+
+// Registra el hijo `pid`, que ejecuta `cmd`. Si `bg` es un trabajo en
+// segundo plano y recibe un número; si no, es la orden en primer plano.
+// Retorna su índice en la tabla.
+int job_add(int pid, struct cmd *cmd, int bg){
+    char text[MAXPATH] = "";
+    struct job *job;
+    int id = 0;
+    if (njobs == capjobs){
+        capjobs = capjobs ? capjobs * 2 : 16;
+        if ((jobs = realloc(jobs, capjobs * sizeof(*jobs))) == NULL){
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    child_epoll();
+    cmd_text(cmd, text, sizeof(text));
+    if (bg)
+        id = job_next_id();
+    job = &jobs[njobs];
+    job->id = id;
+    job->pid = pid;
+#ifdef SYS_pidfd_open
+    job->pidfd = syscall(SYS_pidfd_open, pid, 0);
+#else
+    job->pidfd = -1;
+#endif
+    if (job->pidfd != -1){
+        struct epoll_event ev = { .events = EPOLLIN, .data.fd = job->pidfd };
+        if (epoll_ctl(child_epfd, EPOLL_CTL_ADD, job->pidfd, &ev) == -1){
+            close(job->pidfd);
+            job->pidfd = -1;
+        }
+    }
+    job->state = JOB_RUNNING;
+    job->status = 0;
+    job->deadline = 0;
+    job->left = 0;
+    job->cgroup = NULL;
+    job->text = strdup(text);
+    job->timed = 0;
+    clock_gettime(CLOCK_MONOTONIC, &job->start);
+    if (bg){
+        fprintf(stdout, "[%d] %d\n", job->id, pid);
+        fflush(stdout);
+    }
+    return njobs++;
+}
+
+// Pasa `job` a parado y guarda lo que le quedaba de plazo.
+void job_stop(struct job *job){
+    if (job->state != JOB_RUNNING)
+        return;
+    job->state = JOB_STOPPED;
+    job->left = 0;
+    if (job->deadline){
+        long long now = now_ms();
+        job->left = job->deadline > now ? job->deadline - now : 1;
+    }
+    job->deadline = 0;
+}
+
+// Pasa `job` a en ejecución; el plazo sigue donde se quedó.
+void job_cont(struct job *job){
+    if (job->state != JOB_STOPPED)
+        return;
+    job->state = JOB_RUNNING;
+    if (job->left)
+        job->deadline = now_ms() + job->left;
+    job->left = 0;
+}
+
+// Recoge el trabajo `job` si ha terminado, sin bloquear, o anota que se
+// ha parado o que ha continuado.
+void job_reap(struct job *job){
+    struct rusage ru;
+    int status;
+    if (job->state == JOB_DONE
+            || wait4(job->pid, &status, WNOHANG | WUNTRACED | WCONTINUED, &ru) <= 0)
+        return;
+    if (WIFSTOPPED(status)){
+        job_stop(job);
+        job->status = status;
+        return;
+    }
+    if (WIFCONTINUED(status)){
+        job_cont(job);
+        return;
+    }
+    job->ru = ru;
+    clock_gettime(CLOCK_MONOTONIC, &job->end);
+    job->state = JOB_DONE;
+    job->status = status;
+    count++;
+    acct_log(job);
+    // Se quita del epoll explícitamente: algún hijo puede haber heredado
+    // una copia del pidfd y entonces `close()` no bastaría.
+    if (job->pidfd != -1){
+        epoll_ctl(child_epfd, EPOLL_CTL_DEL, job->pidfd, NULL);
+        close(job->pidfd);
+    }
+    job->pidfd = -1;
+    if (job->cgroup)
+        cg_remove(job->cgroup);
+    job->cgroup = NULL;
+}
+
+void job_remove(int i){
+    free(jobs[i].text);
+    memmove(&jobs[i], &jobs[i + 1], (njobs - i - 1) * sizeof(*jobs));
+    njobs--;
+}
+
+// Mata todo el árbol del trabajo `job`: su cgroup, si tiene, y su grupo
+// de procesos.
+void job_kill(struct job *job){
+    if (job->cgroup)
+        cg_kill(job->cgroup);
+    if (!job_control || kill(-job->pid, SIGKILL) == -1)
+        kill(job->pid, SIGKILL);
+}
+
+// Como `fork1()`, pero con control de trabajos el hijo empieza su propio
+// grupo de procesos y, si `cg` no es NULL, entra en ese cgroup. El padre
+// hace lo mismo para que el grupo exista antes de que ninguno de los dos
+// siga.
+int fork_job(char *cg){
+    char pid_str[16];
+    int pid;
+    fflush(stdout);
+    if ((pid = fork1()) == 0){
+        if (job_control)
+            setpgid(0, 0);
+        if (cg)
+            cg_write(cg, "cgroup.procs", "0");
+        return 0;
+    }
+    if (job_control)
+        setpgid(pid, pid);
+    if (cg){
+        snprintf(pid_str, sizeof(pid_str), "%d", pid);
+        cg_write(cg, "cgroup.procs", pid_str);
+    }
+    return pid;
+}
+
+// Retorna el índice del trabajo `arg` (`N` o `%N`), o del último si es
+// NULL; -1 si no existe.
+int job_find(char *arg){
+    int id;
+    if (arg == NULL)
+        return njobs - 1;
+    if (sscanf(arg[0] == '%' ? arg + 1 : arg, "%d", &id) != 1 || id == 0)
+        return -1;
+    for (int i = 0; i < njobs; i++)
+        if (jobs[i].id == id)
+            return i;
+    return -1;
+}
+
+// Recoge, sin bloquear, los trabajos que han terminado.
+void jobs_reap(void){
+    for (int i = 0; i < njobs; i++)
+        job_reap(&jobs[i]);
+}
+
+// Espera hasta que termine algún hijo, venza algún plazo o, si `fd` no
+// es -1, haya datos en `fd`. Recoge los hijos que terminan y mata a los
+// que han superado su plazo. Retorna 1 si hay datos en `fd` y -1 si una
+// señal ha interrumpido la espera.
+int children_wait(int fd){
+    struct epoll_event evs[16];
+    long long now = now_ms(), next = 0;
+    int timeout = -1, ready = 0, n;
+    child_epoll();
+    for (int i = 0; i < njobs; i++){
+        if (jobs[i].state != JOB_RUNNING)
+            continue;
+        if (jobs[i].deadline && (next == 0 || jobs[i].deadline < next))
+            next = jobs[i].deadline;
+        if (jobs[i].pidfd == -1)
+            timeout = CHILD_POLLMS;
+    }
+    if (next && (timeout == -1 || next - now < timeout))
+        timeout = next > now ? next - now : 0;
+    if (fd != -1){
+        struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+        // Un fichero regular (`simplesh < guion`) no admite epoll (EPERM)
+        // y siempre se puede leer: sólo se recoge lo que haya, sin esperar.
+        if (epoll_ctl(child_epfd, EPOLL_CTL_ADD, fd, &ev) == -1){
+            fd = -1;
+            ready = 1;
+            timeout = 0;
+        }
+    }
+    n = epoll_wait(child_epfd, evs, 16, timeout);
+    if (n == -1){
+        if (errno != EINTR){
+            perror("epoll_wait");
+            exit(EXIT_FAILURE);
+        }
+        if (!ready)
+            ready = -1;
+    }
+    if (fd != -1)
+        epoll_ctl(child_epfd, EPOLL_CTL_DEL, fd, NULL);
+    for (int e = 0; e < n; e++){
+        if (evs[e].data.fd == fd)
+            ready = 1;
+        else if (evs[e].data.fd == child_pipe[0]){
+            char buf[64];
+            while (read(child_pipe[0], buf, sizeof(buf)) > 0)
+                ;
+            jobs_reap();
+        }
+        else
+            for (int i = 0; i < njobs; i++)
+                if (jobs[i].pidfd == evs[e].data.fd)
+                    job_reap(&jobs[i]);
+    }
+    // Los hijos sin pidfd se comprueban siempre.
+    now = now_ms();
+    for (int i = 0; i < njobs; i++){
+        if (jobs[i].state != JOB_RUNNING)
+            continue;
+        if (jobs[i].pidfd == -1)
+            job_reap(&jobs[i]);
+        if (jobs[i].state == JOB_RUNNING && jobs[i].deadline && jobs[i].deadline <= now){
+            fprintf(stderr, "simplesh: [%d] Matado hijo con PID %d\n", count, jobs[i].pid);
+            job_kill(&jobs[i]);
+            // Ya no tiene plazo: sólo falta recogerlo.
+            jobs[i].deadline = 0;
+        }
+    }
+    return ready;
+}
+
+// Espera a que termine o se pare el trabajo `i` atendiendo a la vez al
+// resto. Retorna su estado de `waitpid()`.
+int job_wait(int i){
+    struct sigaction sa = { .sa_handler = sigchld_handler, .sa_flags = SA_RESTART }, old;
+    char buf[64];
+    child_epoll();
+    sigaction(SIGCHLD, &sa, &old);
+    // Se ha podido parar antes de instalar el manejador.
+    job_reap(&jobs[i]);
+    while (jobs[i].state == JOB_RUNNING)
+        children_wait(-1);
+    sigaction(SIGCHLD, &old, NULL);
+    // Sin manejador no llegan más avisos: se vacía la tubería para que no
+    // despierte al *prompt*.
+    while (read(child_pipe[0], buf, sizeof(buf)) > 0)
+        ;
+    return jobs[i].status;
+}
+
+void job_print(struct job *job){
+    if (job->state == JOB_RUNNING)
+        fprintf(stdout, "[%d] Ejecutando %d\t%s\n", job->id, job->pid, job->text);
+    else if (job->state == JOB_STOPPED)
+        fprintf(stdout, "[%d] Detenido %d\t%s\n", job->id, job->pid, job->text);
+    else if (WIFSIGNALED(job->status))
+        fprintf(stdout, "[%d] %s\t%s\n", job->id, strsignal(WTERMSIG(job->status)), job->text);
+    else if (WEXITSTATUS(job->status) != 0)
+        fprintf(stdout, "[%d] Salida %d\t%s\n", job->id, WEXITSTATUS(job->status), job->text);
+    else
+        fprintf(stdout, "[%d] Hecho\t%s\n", job->id, job->text);
+}
+
+// Avisa de los trabajos terminados y los quita de la tabla.
+void jobs_notify(void){
+    jobs_reap();
+    for (int i = 0; i < njobs; )
+        if (jobs[i].state == JOB_DONE && jobs[i].id != 0){
+            job_print(&jobs[i]);
+            if (jobs[i].timed)
+                job_times(&jobs[i]);
+            job_remove(i);
+        }
+        else
+            i++;
+    fflush(stdout);
+}
+
+// Sustituye a `rl_getc()` para recoger los trabajos que terminan mientras
+// se espera una tecla. El manejador de readline sólo anota las señales
+// (SIGTERM, SIGHUP, SIGWINCH...) y las atiende al volver su lectura con
+// EINTR, así que aquí se hace lo mismo: si no, se perderían.
+int jobs_getc(FILE *in){
+    int r;
+    while ((r = children_wait(fileno(in))) != 1){
+        if (r == -1){
+#if RL_READLINE_VERSION >= 0x0801
+            rl_check_signals();
+#else
+            break;
+#endif
+        }
+    }
+    return rl_getc(in);
+}
+
+// Lanza `bcmd` en segundo plano con el plazo `deadline` y lo añade a la
+// tabla de trabajos. Con `timed` se imprimen sus recursos al avisar de
+// que ha terminado.
+void run_back(struct backcmd *bcmd, long long deadline, int timed){
+    char *cg = cg_create();
+    int pid, i;
+    hash_prefetch(bcmd->cmd);
+    if ((pid = fork_job(cg)) == 0)
+        run_cmd(bcmd->cmd);
+    i = job_add(pid, bcmd->cmd, 1);
+    jobs[i].deadline = deadline;
+    jobs[i].timed = timed;
+    jobs[i].cgroup = cg;
+}
+
+// `jobs`: lista los trabajos y avisa de los terminados.
+void run_jobs(void){
+    jobs_reap();
+    for (int i = 0; i < njobs; i++)
+        if (jobs[i].state != JOB_DONE)
+            job_print(&jobs[i]);
+    jobs_notify();
+}
+
+// `wait [N...]`: espera a los trabajos indicados, o a todos.
+void run_wait(struct execcmd *ecmd){
+    for (int i = 0; i < njobs && ecmd->argv[1] == NULL; i++)
+        job_wait(i);
+    for (int a = 1; ecmd->argv[a]; a++){
+        int i = job_find(ecmd->argv[a]);
+        if (i == -1)
+            fprintf(stderr, "simplesh: wait: %s: no existe ese trabajo\n", ecmd->argv[a]);
+        else
+            job_wait(i);
+    }
+    jobs_notify();
+}
+
+// Muestra un *prompt* y lee lo que el usuario escribe usando la
+// librería readline. Ésta permite almacenar en el historial, utilizar
+// las flechas para acceder a las órdenes previas, búsquedas de
+// órdenes, etc.
+char* getcmd() {
+    char *buf;
+    int retval = 0;
+    // Obtenemos el nombre de usuario a partir del uid.
+	char* username = getpwuid(getuid())->pw_name;
+	if (username == NULL){
+		perror("getpwuid");
+		exit(EXIT_FAILURE);
+	}
+
+    // Obtenemos el path actual.
+	char path[MAXPATH];
+	if (getcwd(path, MAXPATH) == NULL){
+		perror("getcwd");
+		exit(EXIT_FAILURE);
+	}
+	// Boletin 2, ejercicio 2. Creamos el prompt quedandonos con el basename del path.
+	char prompt[MAXPATH];
+	snprintf(prompt, MAXPATH,"%s@%s$ ", username, basename(path));
+	
+    // Avisamos de los trabajos en segundo plano que han terminado.
+    jobs_notify();
+    // Lee la entrada del usuario
+    buf = readline (prompt);
+    fflush(stdout);
+
+    // Si el usuario ha escrito algo, almacenarlo en la historia.
+    if(buf)
+        add_history (buf);
+
+    return buf;
+}
+
+static int sigus_timeout = INITIAL_TIMEOUT;
+// Handler para incrementar o decrementar el timeout.
+static void sigus_handler(int sig){
+    if (sig == SIGUSR1){
+        sigus_timeout += 5;
+    }
+    else if (sig == SIGUSR2 && sigus_timeout > 5){
+        sigus_timeout -= 5;
+    }
+        
+}
+
+// Da el terminal al grupo `pgid`. Hace falta bloquear SIGTTOU porque el
+// shell puede no tenerlo en ese momento.
+void term_give(int pgid){
+    sigset_t ttou, old;
+    if (!job_control)
+        return;
+    sigemptyset(&ttou);
+    sigaddset(&ttou, SIGTTOU);
+    sigprocmask(SIG_BLOCK, &ttou, &old);
+    tcsetpgrp(STDIN_FILENO, pgid);
+    sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+// Plazo en ms del reloj monótono para un trabajo con el prefijo
+// `timeout SECS` (-1 si no lo tiene). Sin prefijo, las órdenes en primer
+// plano tienen el timeout de simplesh y las de segundo plano ninguno;
+// `timeout 0` quita el plazo.
+long long job_deadline(int secs, int fg){
+    if (secs < 0)
+        secs = fg ? sigus_timeout : 0;
+    return secs > 0 ? now_ms() + secs * 1000LL : 0;
+}
+
+// Quita los prefijos `timeout SECS` y `time`, en cualquier orden, de la
+// primera orden simple de `cmd`. Deja en `secs` SECS (-1 si no hay
+// `timeout`) y en `timed` si hay `time`. Retorna -1 si están mal
+// escritos o no les sigue ninguna orden.
+int line_prefixes(struct cmd *cmd, int *secs, int *timed){
+    struct execcmd *ecmd;
+    int skip, i;
+    *secs = -1;
+    *timed = 0;
+    while (cmd->type != EXEC){
+        if (cmd->type == REDIR)
+            cmd = ((struct redircmd*)cmd)->cmd;
+        else if (cmd->type == BACK)
+            cmd = ((struct backcmd*)cmd)->cmd;
+        else
+            cmd = ((struct pipecmd*)cmd)->left;
+    }
+    ecmd = (struct execcmd*)cmd;
+    for (;;){
+        if (ecmd->argv[0] == NULL)
+            return 0;
+        if (strcmp(ecmd->argv[0], "time") == 0){
+            *timed = 1;
+            skip = 1;
+        }
+        else if (strcmp(ecmd->argv[0], "timeout") == 0){
+            if (ecmd->argv[1] == NULL || sscanf(ecmd->argv[1], "%d", secs) != 1 || *secs < 0)
+                return -1;
+            skip = 2;
+        }
+        else
+            return 0;
+        if (ecmd->argv[skip] == NULL)
+            return -1;
+        for (i = 0; ecmd->argv[i + skip]; i++)
+            ecmd->argv[i] = ecmd->argv[i + skip];
+        ecmd->argv[i] = NULL;
+        ecmd->argc = i;
+    }
+}
+
+// Tiene el trabajo `i` en primer plano hasta que termina o se para.
+// Mientras tanto, su grupo tiene el terminal; se reanuda por si estaba
+// parado o se paró al leer de él antes de tenerlo. Si se para, el shell
+// recupera el terminal y el trabajo queda en la tabla con número. Con
+// `timed` se imprimen los recursos que ha usado al terminar. Retorna su
+// estado de `waitpid()`.
+int job_fg(int i, int timed){
+    int status;
+    term_give(jobs[i].pid);
+    job_cont(&jobs[i]);
+    if (!job_control || kill(-jobs[i].pid, SIGCONT) == -1)
+        kill(jobs[i].pid, SIGCONT);
+    status = job_wait(i);
+    term_give(getpgrp());
+    if (jobs[i].state == JOB_STOPPED){
+        if (jobs[i].id == 0)
+            jobs[i].id = job_next_id();
+        jobs[i].timed |= timed;
+        fprintf(stdout, "\n");
+        job_print(&jobs[i]);
+        fflush(stdout);
+        return status;
+    }
+    if (timed || jobs[i].timed)
+        job_times(&jobs[i]);
+    job_remove(i);
+    return status;
+}
+
+// Espera al hijo `pid` en primer plano hasta `deadline` y mata su árbol
+// si lo supera. Retorna su estado de `waitpid()`.
+int wait_fg(int pid, struct cmd *cmd, long long deadline, char *cg, int timed){
+    int i = job_add(pid, cmd, 0);
+    jobs[i].deadline = deadline;
+    jobs[i].cgroup = cg;
+    return job_fg(i, timed);
+}
+
+// `fg [N]`: pasa el trabajo N (o el último) a primer plano. Con
+// `timeout SECS fg` recibe ese plazo; si no, conserva el suyo o, si no
+// tiene, recibe el timeout de las órdenes en primer plano. Con `time fg`
+// o si se lanzó con `time`, se imprimen sus recursos.
+void run_fg(struct execcmd *ecmd, int secs, int timed){
+    int i = job_find(ecmd->argv[1]);
+    jobs_reap();
+    if (i == -1){
+        fprintf(stderr, "simplesh: fg: %s: no existe ese trabajo\n", ecmd->argv[1] ? ecmd->argv[1] : "actual");
+        return;
+    }
+    fprintf(stdout, "%s\n", jobs[i].text);
+    fflush(stdout);
+    if (jobs[i].state != JOB_DONE){
+        // Un trabajo parado recupera lo que le quedaba de plazo.
+        job_cont(&jobs[i]);
+        if (secs >= 0 || jobs[i].deadline == 0)
+            jobs[i].deadline = job_deadline(secs, 1);
+        job_fg(i, timed);
+        return;
+    }
+    // Si ya había terminado, se avisa como en `jobs`.
+    job_print(&jobs[i]);
+    if (timed || jobs[i].timed)
+        job_times(&jobs[i]);
+    job_remove(i);
+}
+
+// Indica si la orden `cmd` de una lista ha de ejecutarse como una línea
+// propia: va en segundo plano o es un comando interno del shell.
+int list_own_line(struct cmd *cmd){
+    struct execcmd *ecmd = (struct execcmd*)cmd;
+    return cmd->type == BACK
+        || (cmd->type == EXEC && ecmd->argv[0] && is_shell_builtin(ecmd->argv[0]));
+}
+
+// Indica si la lista `cmd` ha de ejecutarse orden a orden.
+int list_split(struct cmd *cmd){
+    if (cmd->type != LIST)
+        return 0;
+    for (; cmd->type == LIST; cmd = ((struct listcmd*)cmd)->right)
+        if (list_own_line(((struct listcmd*)cmd)->left))
+            return 1;
+    return list_own_line(cmd);
+}
+
+// Ejecuta una orden ya analizada. `exit` y `cd` se ejecutan en el
+// propio shell; el resto en un hijo vigilado por el timeout de simplesh.
+void exec_line(struct cmd *command){
+    // Sólo las órdenes simples pueden ser `exit`, `cd` o `arena`.
+    char *name = NULL;
+    int secs, timed, inshell = 1;
+    struct shell_usage usage;
+    jobs_reap();
+    // `a & ; b`, `a ; b &` o `a ; jobs`: cada orden de la lista se ejecuta
+    // como otra línea, para que las de segundo plano sean trabajos y los
+    // comandos internos se ejecuten en el shell.
+    if (list_split(command)){
+        exec_line(((struct listcmd*)command)->left);
+        exec_line(((struct listcmd*)command)->right);
+        return;
+    }
+    glob_cmd(command);
+    // `timeout SECS orden`: plazo propio para toda la línea; `time orden`:
+    // imprimir lo que ha usado.
+    if (line_prefixes(command, &secs, &timed) == -1){
+        fprintf(stderr, "Uso: [time] [timeout SECS] ORDEN\n");
+        return;
+    }
+    if (command->type == EXEC)
+        name = ((struct execcmd*)command)->argv[0];
+    if (timed)
+        shell_usage_start(&usage);
+    // Boletin 2, ejercicio 4.
+    // Añadimos en los dos ifs siguientes la comprobación de NULL para
+    // evitar violación de segmento cuando el comando está vacío.
+    if (name != NULL && strcmp(name, "exit") == 0)
+        exit(0);
+    // Boletin 2, ejercicio 5.
+    else if (name != NULL && strcmp(name, "cd") == 0)
+        run_cd(command);
+    else if (name != NULL && strcmp(name, "arena") == 0)
+        run_arena();
+    else if (name != NULL && strcmp(name, "launcher") == 0)
+        run_launcher((struct execcmd*)command);
+    else if (name != NULL && strcmp(name, "hash") == 0)
+        run_hash((struct execcmd*)command);
+    else if (name != NULL && strcmp(name, "pcache") == 0)
+        run_pcache((struct execcmd*)command);
+    else if (name != NULL && strcmp(name, "jobs") == 0)
+        run_jobs();
+    else if (name != NULL && strcmp(name, "wait") == 0)
+        run_wait((struct execcmd*)command);
+    else if (name != NULL && strcmp(name, "fg") == 0){
+        run_fg((struct execcmd*)command, secs, timed);
+        inshell = 0;
+    }
+    else if (name != NULL && strcmp(name, "cgroup") == 0)
+        run_cgroup((struct execcmd*)command);
+    else if (name != NULL && strcmp(name, "acct") == 0)
+        run_acct((struct execcmd*)command);
+    // Las órdenes en segundo plano pasan a la tabla de trabajos.
+    else if (command->type == BACK){
+        run_back((struct backcmd*)command, job_deadline(secs, 0), timed);
+        inshell = 0;
+    }
+    // Los comandos internos fuera de una tubería se ejecutan sin hijo,
+    // salvo que tengan plazo propio o se midan.
+    else if (builtin_cmd(command) != NULL && secs < 0 && !timed)
+        run_builtin_inproc(command);
+    // Crear un hijo para ejecutar el comando leído
+    else{
+        int pid;
+        char *cg = cg_create();
+        // Las órdenes externas simples se lanzan sin copiar el shell; no
+        // así si tienen cgroup, en el que hay que entrar antes de exec, ni
+        // los comandos internos con prefijo, que han de ejecutarse en el
+        // hijo con `run_cmd()` y no con el programa del mismo nombre.
+        if (launcher == LAUNCH_SPAWN && cg == NULL && simple_cmd(command) != NULL
+                && builtin_cmd(command) == NULL){
+            if ((pid = spawn_cmd(command)) == -1)
+                return;
+        }
+        else{
+            // Creamos el proceso hijo, en su propio grupo, y guardamos su PID
+            hash_prefetch(command);
+            pid = fork_job(cg);
+            // Si somos el hijo, ejecutamos el comando
+            if(pid == 0)
+                run_cmd(command);
+        }
+        wait_fg(pid, command, job_deadline(secs, 1), cg, timed);
+        inshell = 0;
+    }
+    // `fg`, los trabajos y las órdenes en un hijo ya imprimen lo suyo.
+    if (timed && inshell)
+        shell_usage_print(&usage, command);
+}
+
+// Lee completo el descriptor `fd` en un buffer terminado en '\0'. Se usa
+// en el modo no interactivo en lugar de readline: un único buffer que
+// crece por duplicación y lecturas grandes con `read()`.
+char* read_script(int fd){
+    size_t cap = SCRIPTSIZE;
+    size_t len = 0;
+    ssize_t n;
+    char *buf = malloc(cap);
+    if (buf == NULL){
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    while ((n = read(fd, buf + len, cap - len - 1)) != 0){
+        if (n == -1){
+            if (errno == EINTR)
+                continue;
+            perror("read");
+            exit(EXIT_FAILURE);
+        }
+        len += n;
+        if (cap - len - 1 == 0){
+            cap *= 2;
+            if ((buf = realloc(buf, cap)) == NULL){
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    buf[len] = '\0';
+    return buf;
+}
+
+// Modo no interactivo (`-c` o fichero). Se analizan primero todas las
+// líneas de `script`, de forma que un error de sintaxis aborta antes de
+// ejecutar nada, y después se ejecutan en orden (salvo con `noexec`, `-n`,
+// que sólo las analiza). No se inicializa readline ni el historial.
+void run_script(char *script, int noexec){
+    size_t ncmds = 0;
+    size_t cap = 16;
+    struct cmd **cmds = malloc(cap * sizeof(*cmds));
+    if (cmds == NULL){
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    char *line = script;
+    while (*line){
+        // Cortamos la línea en el salto de línea y la analizamos en su sitio.
+        char *nl = strchr(line, '\n');
+        char *next = nl ? nl + 1 : line + strlen(line);
+        if (nl)
+            *nl = '\0';
+        struct cmd *command = parse_cached(line);
+        // Las líneas vacías no generan ninguna orden.
+        if (command->type != EXEC || ((struct execcmd*)command)->argv[0] != NULL){
+            if (ncmds == cap){
+                cap *= 2;
+                if ((cmds = realloc(cmds, cap * sizeof(*cmds))) == NULL){
+                    perror("realloc");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            cmds[ncmds++] = command;
+        }
+        line = next;
+    }
+    for (size_t i = 0; i < ncmds && !noexec; i++)
+        exec_line(cmds[i]);
+    free(cmds);
+    arena_reset();
+}
+
+// MAIN ----
+
+int main(int argc, char *argv[]) {
+    char* buf;
+    char* script = NULL;
+    int noexec = 0;
+    
+    // `-n`: sólo analizar las órdenes, sin ejecutarlas.
+    if (argc > 1 && strcmp(argv[1], "-n") == 0){
+        noexec = 1;
+        argc--;
+        argv++;
+    }
+    // Modo no interactivo: `simplesh -c ORDEN` o `simplesh FICHERO`.
+    if (argc > 1){
+        if (strcmp(argv[1], "-c") == 0){
+            if (argc < 3){
+                fprintf(stderr, "Uso: simplesh [-n] [-c ORDEN | FICHERO]\n");
+                exit(EXIT_FAILURE);
+            }
+            script = argv[2];
+        }
+        else{
+            int fd = open(argv[1], O_RDONLY);
+            if (fd == -1){
+                perror(argv[1]);
+                exit(EXIT_FAILURE);
+            }
+            script = read_script(fd);
+            close(fd);
+        }
+    }
+
+    // Creamos un set de señales
+    sigset_t blocked_signals;
+    // Nos aseguramos de que está vacío.
+    if (sigemptyset(&blocked_signals) == -1){
+        perror("sigemptyset");
+        exit(EXIT_FAILURE);
+    }
+    // Añadimos SIGINT. SIGCHLD no se bloquea: los hijos se esperan por
+    // sus pidfd y, mientras se espera a un trabajo, su manejador avisa de
+    // los que se paran (ver `job_wait()`).
+    if (sigaddset(&blocked_signals, SIGINT) == -1){
+        perror("sigaddset");
+        exit(EXIT_FAILURE);
+    }
+    // Bloqueamos las señales del set creado, es decir, bloqueamos SIGINT.
+    if (sigprocmask(SIG_BLOCK, &blocked_signals, NULL) == -1){
+        perror("sigprocmask");
+        exit(EXIT_FAILURE);
+    }
+    //Le asignamos manejador a SIGUSR1 y SIGUSR2.
+    struct sigaction sigusr;
+    sigusr.sa_handler = sigus_handler;
+    if (sigaction(SIGUSR1, &sigusr, NULL) == -1){
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+    if (sigaction(SIGUSR2, &sigusr, NULL) == -1){
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+    
+    // Registro de recursos de los trabajos desde el principio de la sesión.
+    if (getenv("SIMPLESH_ACCT") != NULL)
+        acct_open(getenv("SIMPLESH_ACCT"));
+    pcache_init();
+
+    if (script != NULL){
+        run_script(script, noexec);
+        return 0;
+    }
+
+    // Mientras se espera una tecla se recogen los trabajos que terminan.
+    rl_getc_function = jobs_getc;
+    // Con terminal, cada orden en primer plano lo recibe mientras dura.
+    job_control = isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == getpgrp();
+    // Bucle de lectura y ejecución de órdenes.
+    while (NULL != (buf = getcmd()))
+    {
+        // Parseamos el comando antes de ejecutarlo
+        exec_line(parse_cached(buf));
+        // Liberamos de una vez el árbol de la orden y la línea leída.
+        arena_reset();
+        free ((void*)buf);
+    } 
+
+    return 0;
+}
+
+void
+panic(char *s)
+{
+    fprintf(stderr, "%s\n", s);
+    exit(-1);
+}
+
+// Como `fork()` salvo que muestra un mensaje de error si no se puede
+// crear el hijo.
+int
+fork1(void)
+{
+    int pid;
+
+    pid = fork();
+    if(pid == -1)
+        panic("fork");
+    return pid;
+}
+
+// Constructores de las estructuras `cmd`.
+// ----
+
+// Construye una estructura `EXEC`.
+struct cmd*
+execcmd(void)
+{
+    struct execcmd *cmd;
+
+    cmd = arena_alloc(sizeof(*cmd));
+    cmd->type = EXEC;
+    cmd->cap = ARGVSIZE;
+    cmd->argv = arena_alloc(ARGVSIZE * sizeof(char*));
+    cmd->eargv = arena_alloc(ARGVSIZE * sizeof(char*));
+    return (struct cmd*)cmd;
+}
+
+// Añade a `cmd` el argumento que va de `q` a `eq`. Si no cabe, los
+// vectores se copian a otros del doble de tamaño en la arena; los
+// antiguos se liberan con el resto de la línea, y el coste total sigue
+// siendo lineal en el número de argumentos.
+void
+execcmd_push(struct execcmd *cmd, char *q, char *eq)
+{
+    if (cmd->argc + 1 == cmd->cap)
+    {
+        char **argv = arena_alloc(2 * cmd->cap * sizeof(char*));
+        char **eargv = arena_alloc(2 * cmd->cap * sizeof(char*));
+        memcpy(argv, cmd->argv, cmd->argc * sizeof(char*));
+        memcpy(eargv, cmd->eargv, cmd->argc * sizeof(char*));
+        cmd->argv = argv;
+        cmd->eargv = eargv;
+        cmd->cap *= 2;
+    }
+    cmd->argv[cmd->argc] = q;
+    cmd->eargv[cmd->argc] = eq;
+    cmd->argc++;
+}
+
+// Construye una estructura de redirección.
+struct cmd*
+redircmd(struct cmd *subcmd, char *file, char *efile, int mode, int fd)
+{
+    struct redircmd *cmd;
+
+    cmd = arena_alloc(sizeof(*cmd));
+    cmd->type = REDIR;
+    cmd->cmd = subcmd;
+    cmd->file = file;
+    cmd->efile = efile;
+    cmd->mode = mode;
+    cmd->fd = fd;
+    return (struct cmd*)cmd;
+}
+
+// Construye una estructura de tubería (*pipe*).
+struct cmd*
+pipecmd(struct cmd *left, struct cmd *right)
+{
+    struct pipecmd *cmd;
+
+    cmd = arena_alloc(sizeof(*cmd));
+    cmd->type = PIPE;
+    cmd->left = left;
+    cmd->right = right;
+    return (struct cmd*)cmd;
+}
+
+// Construye una estructura de lista de órdenes.
+struct cmd*
+listcmd(struct cmd *left, struct cmd *right)
+{
+    struct listcmd *cmd;
+
+    cmd = arena_alloc(sizeof(*cmd));
+    cmd->type = LIST;
+    cmd->left = left;
+    cmd->right = right;
+    return (struct cmd*)cmd;
+}
+
+// Construye una estructura de ejecución que incluye una ejecución en
+// segundo plano.
+struct cmd*
+backcmd(struct cmd *subcmd)
+{
+    struct backcmd *cmd;
+
+    cmd = arena_alloc(sizeof(*cmd));
+    cmd->type = BACK;
+    cmd->cmd = subcmd;
+    return (struct cmd*)cmd;
+}
+
+// Parsing
+// ----
+
+// Clase de cada byte: espacios (" \t\r\n\v") y símbolos ("<|>&;()").
+// Una consulta por carácter en lugar de recorrer ambos conjuntos con
+// `strchr()`. Los argumentos son los bytes de clase 0.
+#define CT_SPACE  1
+#define CT_SYMBOL 2
+
+static const unsigned char ctype_tab[256] = {
+    [' '] = CT_SPACE, ['\t'] = CT_SPACE, ['\r'] = CT_SPACE, ['\n'] = CT_SPACE, ['\v'] = CT_SPACE,
+    ['<'] = CT_SYMBOL, ['|'] = CT_SYMBOL, ['>'] = CT_SYMBOL, ['&'] = CT_SYMBOL,
+    [';'] = CT_SYMBOL, ['('] = CT_SYMBOL, [')'] = CT_SYMBOL,
+};
+
+#define is_space(c) (ctype_tab[(unsigned char)(c)] == CT_SPACE)
+
+// Salta los bytes de un argumento desde `s`. Con SSE2 se comparan 16
+// bytes a la vez con todos los espacios y símbolos y sólo se mira la
+// tabla en los últimos. Sin optimizar (-O0, como en el Makefile) las
+// intrínsecas no se expanden y la tabla sola es más rápida.
+static inline char* skip_arg(char *s, char *end_of_str){
+#if defined(__SSE2__) && defined(__OPTIMIZE__)
+    static const char special[] = " \t\r\n\v<|>&;()";
+    while (end_of_str - s >= 16){
+        __m128i v = _mm_loadu_si128((const __m128i*)s);
+        __m128i m = _mm_setzero_si128();
+        for (size_t i = 0; i < sizeof(special) - 1; i++)
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(special[i])));
+        int mask = _mm_movemask_epi8(m);
+        if (mask)
+            return s + __builtin_ctz(mask);
+        s += 16;
+    }
+#endif
+    while (s < end_of_str && ctype_tab[(unsigned char)*s] == 0)
+        s++;
+    return s;
+}
+
+// Obtiene un *token* de la cadena de entrada `ps`, y hace que `q` apunte a
+// él (si no es `NULL`).
+int
+gettoken(char **ps, char *end_of_str, char **q, char **eq)
+{
+    char *s;
+    int ret;
+
+    s = *ps;
+    while (s < end_of_str && is_space(*s))
+        s++;
+    if (q)
+        *q = s;
+    ret = *s;
+    switch (*s)
+    {
+    case 0:
+        break;
+    case '|':
+    case '(':
+    case ')':
+    case ';':
+    case '&':
+    case '<':
+        s++;
+        break;
+    case '>':
+        s++;
+        if (*s == '>')
+        {
+            ret = '+';
+            s++;
+        }
+        break;
+
+    default:
+        // El caso por defecto (no hay caracteres especiales) es el de un
+        // argumento de programa. Se retorna el valor `'a'`, `q` apunta al
+        // mismo (si no era `NULL`), y `ps` se avanza hasta que salta todos
+        // los espacios **después** del argumento. `eq` se hace apuntar a
+        // donde termina el argumento. Así, si `ret` es `'a'`:
+        //
+        //     |-----------+---+---+---+---+---+---+---+---+---+-----------|
+        //     | (espacio) | a | r | g | u | m | e | n | t | o | (espacio) |
+        //     |-----------+---+---+---+---+---+---+---+---+---+-----------|
+        //                   ^                                   ^
+        //                   |q                                  |eq
+        //
+        ret = 'a';
+        s = skip_arg(s, end_of_str);
+        break;
+    }
+
+    // Apuntar `eq` (si no es `NULL`) al final del argumento.
+    if (eq)
+        *eq = s;
+
+    // Y finalmente saltar los espacios en blanco y actualizar `ps`.
+    while(s < end_of_str && is_space(*s))
+        s++;
+    *ps = s;
+
+    return ret;
+}
+
+// La función `peek()` recibe un puntero a una cadena, `ps`, y un final de
+// cadena, `end_of_str`, y un conjunto de tokens (`toks`). El puntero
+// pasado, `ps`, es llevado hasta el primer carácter que no es un espacio y
+// posicionado ahí. La función retorna distinto de `NULL` si encuentra el
+// conjunto de caracteres pasado en `toks` justo después de los posibles
+// espacios.
+int
+peek(char **ps, char *end_of_str, char *toks)
+{
+    char *s;
+
+    s = *ps;
+    while(s < end_of_str && is_space(*s))
+        s++;
+    *ps = s;
+
+    return *s && strchr(toks, *s);
+}
+
+// Definiciones adelantadas de funciones.
+struct cmd *parse_line(char**, char*);
+struct cmd *parse_pipe(char**, char*);
+struct cmd *parse_exec(char**, char*);
+struct cmd *nulterminate(struct cmd*);
+
+// Función principal que hace el *parsing* de una línea de órdenes dada por
+// el usuario. Llama a la función `parse_line()` para obtener la estructura
+// `cmd`.
+struct cmd*
+parse_cmd(char *s)
+{
+    char *end_of_str;
+    struct cmd *cmd;
+
+    end_of_str = s + strlen(s);
+    arena_parse_start();
+    cmd = parse_line(&s, end_of_str);
+
+    peek(&s, end_of_str, "");
+    if (s != end_of_str)
+    {
+        fprintf(stderr, "restante: %s\n", s);
+        panic("syntax");
+    }
+
+    // Termina en `'\0'` todas las cadenas de caracteres de `cmd`.
+    nulterminate(cmd);
+
+    arena_parse_end();
+
+    return cmd;
+}
+
+// *Parsing* de una línea. Se comprueba primero si la línea contiene alguna
+// tubería. Si no, puede ser un comando en ejecución con posibles
+// redirecciones o un bloque. A continuación puede especificarse que se
+// ejecuta en segundo plano (con `&`) o simplemente una lista de órdenes
+// (con `;`).
+struct cmd*
+parse_line(char **ps, char *end_of_str)
+{
+    struct cmd *cmd;
+
+    cmd = parse_pipe(ps, end_of_str);
+    while (peek(ps, end_of_str, "&"))
+    {
+        gettoken(ps, end_of_str, 0, 0);
+        cmd = backcmd(cmd);
+    }
+
+    if (peek(ps, end_of_str, ";"))
+    {
+        gettoken(ps, end_of_str, 0, 0);
+        cmd = listcmd(cmd, parse_line(ps, end_of_str));
+    }
+
+    return cmd;
+}
+
+// *Parsing* de una posible tubería con un número de órdenes.
+// `parse_exec()` comprobará la orden, y si al volver el siguiente *token*
+// es un `'|'`, significa que se puede ir construyendo una tubería.
+struct cmd*
+parse_pipe(char **ps, char *end_of_str)
+{
+    struct cmd *cmd;
+
+    cmd = parse_exec(ps, end_of_str);
+    if (peek(ps, end_of_str, "|"))
+    {
+        gettoken(ps, end_of_str, 0, 0);
+        cmd = pipecmd(cmd, parse_pipe(ps, end_of_str));
+    }
+
+    return cmd;
+}
+
+
+// Construye los comandos de redirección si encuentra alguno de los
+// caracteres de redirección.
+struct cmd*
+parse_redirs(struct cmd *cmd, char **ps, char *end_of_str)
+{
+    int tok;
+    char *q, *eq;
+
+    // Si lo siguiente que hay a continuación es una redirección...
+    while (peek(ps, end_of_str, "<>"))
+    {
+        // La elimina de la entrada
+        tok = gettoken(ps, end_of_str, 0, 0);
+
+        // Si es un argumento, será el nombre del fichero de la
+        // redirección. `q` y `eq` tienen su posición.
+        if (gettoken(ps, end_of_str, &q, &eq) != 'a')
+            panic("missing file for redirection");
+
+        switch(tok)
+        {
+        case '<':
+            cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
+            break;
+        // Boletin 2, ejercicio 1. Añadimos los flags para que la semántica de las
+        // redirecciones sea la misma que en bash.
+        case '>':
+            cmd = redircmd(cmd, q, eq, O_RDWR|O_CREAT|O_TRUNC, 1);
+            break;
+        case '+':  // >>
+            cmd = redircmd(cmd, q, eq, O_RDWR|O_CREAT|O_APPEND, 1);
+            break;
+        }
+    }
+
+    return cmd;
+}
+
+// *Parsing* de un bloque de órdenes delimitadas por paréntesis.
+struct cmd*
+parse_block(char **ps, char *end_of_str)
+{
+    struct cmd *cmd;
+
+    // Esperar e ignorar el paréntesis
+    if (!peek(ps, end_of_str, "("))
+        panic("parse_block");
+    gettoken(ps, end_of_str, 0, 0);
+
+    // Parse de toda la línea hsta el paréntesis de cierre
+    cmd = parse_line(ps, end_of_str);
+
+    // Elimina el paréntesis de cierre
+    if (!peek(ps, end_of_str, ")"))
+        panic("syntax - missing )");
+    gettoken(ps, end_of_str, 0, 0);
+
+    // ¿Posibles redirecciones?
+    cmd = parse_redirs(cmd, ps, end_of_str);
+
+    return cmd;
+}
+
+// Hace en *parsing* de una orden, a no ser que la expresión comience por
+// un paréntesis. En ese caso, se inicia un grupo de órdenes para ejecutar
+// las órdenes de dentro del paréntesis (llamando a `parse_block()`).
+struct cmd*
+parse_exec(char **ps, char *end_of_str)
+{
+    char *q, *eq;
+    int tok;
+    struct execcmd *cmd;
+    struct cmd *ret;
+
+    // ¿Inicio de un bloque?
+    if (peek(ps, end_of_str, "("))
+        return parse_block(ps, end_of_str);
+
+    // Si no, lo primero que hay una línea siempre es una orden. Se
+    // construye el `cmd` usando la estructura `execcmd`.
+    ret = execcmd();
+    cmd = (struct execcmd*)ret;
+
+    // Bucle para separar los argumentos de las posibles redirecciones.
+    ret = parse_redirs(ret, ps, end_of_str);
+    while (!peek(ps, end_of_str, "|)&;"))
+    {
+        if ((tok=gettoken(ps, end_of_str, &q, &eq)) == 0)
+            break;
+
+        // Aquí tiene que reconocerse un argumento, ya que el bucle para
+        // cuando hay un separador
+        if (tok != 'a')
+            panic("syntax");
+
+        // Apuntar el siguiente argumento reconocido. El primero será la
+        // orden a ejecutar.
+        execcmd_push(cmd, q, eq);
+
+        // Y de nuevo apuntar posibles redirecciones
+        ret = parse_redirs(ret, ps, end_of_str);
+    }
+
+    // Finalizar las líneas de órdenes
+    cmd->argv[cmd->argc] = 0;
+    cmd->eargv[cmd->argc] = 0;
+
+    return ret;
+}
+
+// Termina en NUL todas las cadenas de `cmd`.
+struct cmd*
+nulterminate(struct cmd *cmd)
+{
+    int i;
+    struct backcmd *bcmd;
+    struct execcmd *ecmd;
+    struct listcmd *lcmd;
+    struct pipecmd *pcmd;
+    struct redircmd *rcmd;
+
+    if(cmd == 0)
+        return 0;
+
+    switch(cmd->type)
+    {
+    case EXEC:
+        ecmd = (struct execcmd*)cmd;
+        for(i=0; ecmd->argv[i]; i++)
+            *ecmd->eargv[i] = 0;
+        break;
+
+    case REDIR:
+        rcmd = (struct redircmd*)cmd;
+        nulterminate(rcmd->cmd);
+        *rcmd->efile = 0;
+        break;
+
+    case PIPE:
+        pcmd = (struct pipecmd*)cmd;
+        nulterminate(pcmd->left);
+        nulterminate(pcmd->right);
+        break;
+
+    case LIST:
+        lcmd = (struct listcmd*)cmd;
+        nulterminate(lcmd->left);
+        nulterminate(lcmd->right);
+        break;
+
+    case BACK:
+        bcmd = (struct backcmd*)cmd;
+        nulterminate(bcmd->cmd);
+        break;
+    }
+
+    return cmd;
+}
+
+/*
+ * Local variables:
+ * mode: c
+ * c-basic-offset: 4
+ * fill-column: 75
+ * eval: (auto-fill-mode t)
+ * End:
  */
\ No newline at end of file